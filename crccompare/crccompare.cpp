@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// One line of a ChecksumWriter sidecar: frame, pts, 0xcrc...
+struct FrameLine
+{
+   long long frame = 0;
+   long long pts = 0;
+   vector<unsigned long> crcs;
+};
+
+class Sidecar
+{
+public:
+   explicit Sidecar(const char *path)
+   : _path(path)
+   , _in(path)
+   {
+      if (!_in)
+         throw runtime_error(string("Could not open ") + path);
+   }
+
+   // the next frame line, false at the end of the file
+   bool next(FrameLine& line)
+   {
+      string text;
+      while (getline(_in, text)) {
+         ++_lineNumber;
+         if (text.empty())
+            continue;
+         if (text[0] == '#') {
+            if (!text.compare(0, 8, "#stage: "))
+               _stage = text.substr(8);
+            continue;
+         }
+         istringstream fields(text);
+         string field;
+         line.crcs.clear();
+         for (int column(0); getline(fields, field, ','); ++column) {
+            const char *value = field.c_str();
+            char *end;
+            if (column == 0)
+               line.frame = strtoll(value, &end, 10);
+            else if (column == 1)
+               line.pts = strtoll(value, &end, 10);
+            else
+               line.crcs.push_back(strtoul(value, &end, 16));
+            if (end == value)
+               throw runtime_error(_path + ":" + to_string(_lineNumber) + ": not a checksum line");
+         }
+         return true;
+      }
+      return false;
+   }
+
+   const string& stage() const { return _stage; }
+
+private:
+   string _path;
+   ifstream _in;
+   string _stage;
+   int _lineNumber = 0;
+};
+
+static string hex(unsigned long crc)
+{
+   char text[16];
+   snprintf(text, sizeof(text), "0x%08lx", crc);
+   return text;
+}
+
+// Compares two checksum sidecars frame by frame and reports the first frame
+// and plane where they part. Exits 0 when they match, 1 when they don't.
+int
+main(int argc, char **argv)
+try
+{
+   if (argc != 3) {
+      cerr <<"usage: " <<argv[0] <<" reference.crc test.crc" <<endl;
+      return 2;
+   }
+   Sidecar reference(argv[1]), test(argv[2]);
+   FrameLine expected, actual;
+   long long frames(0), divergent(0);
+   bool first(true);
+   for (;;) {
+      bool moreExpected = reference.next(expected);
+      bool moreActual = test.next(actual);
+      if (!moreExpected || !moreActual) {
+         if (moreExpected || moreActual) {
+            // count what is left of the longer one
+            long long left(1);
+            for (Sidecar& longer = moreExpected ? reference : test; longer.next(expected); )
+               ++left;
+            cout <<(moreExpected ? "test" : "reference") <<" ends " <<left <<" frame(s) early, after "
+                 <<frames <<" frame(s)" <<endl;
+            if (first)
+               return 1;
+            divergent += left;
+            frames += left;
+         }
+         break;
+      }
+      if (!frames && reference.stage() != test.stage())
+         cerr <<"warning: comparing " <<reference.stage() <<" checksums with " <<test.stage() <<" checksums" <<endl;
+
+      string difference;
+      if (expected.pts != actual.pts)
+         difference = "pts " + to_string(expected.pts) + " != " + to_string(actual.pts);
+      else if (expected.crcs.size() != actual.crcs.size())
+         difference = to_string(expected.crcs.size()) + " planes != " + to_string(actual.crcs.size());
+      else
+         for (size_t plane(0); plane < expected.crcs.size(); ++plane)
+            if (expected.crcs[plane] != actual.crcs[plane]) {
+               difference = "plane " + to_string(plane) + " " + hex(expected.crcs[plane])
+                          + " != " + hex(actual.crcs[plane]);
+               break;
+            }
+      if (!difference.empty()) {
+         if (first)
+            cout <<"first difference at frame " <<expected.frame <<" (pts " <<expected.pts <<"): "
+                 <<difference <<endl;
+         first = false;
+         ++divergent;
+      }
+      ++frames;
+   }
+   if (divergent) {
+      cout <<divergent <<" of " <<frames <<" frames differ" <<endl;
+      return 1;
+   }
+   cout <<frames <<" frames identical" <<endl;
+   return 0;
+}
+catch (std::exception& e)
+{
+   cerr <<e.what() <<endl;
+   return 2;
+}
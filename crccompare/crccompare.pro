@@ -0,0 +1,11 @@
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# reads the text sidecars only, no libav
+QMAKE_CXXFLAGS += -std=c++11
+
+SOURCES += \
+    crccompare.cpp
@@ -16,6 +16,9 @@
 #include <iomanip>
 #include <exception>
 #include <stdexcept>
+#include <ctime>
+
+#include <sys/time.h>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -33,6 +36,8 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
+#include "trace.h"
+
 AVFormatContext *fmt_ctx = NULL;
 AVCodecContext *video_dec_ctx = NULL;
 AVStream *video_stream = NULL;
@@ -48,6 +53,8 @@ int video_stream_idx = -1;
 AVFrame *frame = NULL;
 AVPacket pkt;
 int video_frame_count = 0;
+// progress goes to stderr when the raw video is streamed to stdout
+FILE *info = stdout;
 
 int decode_packet(int *got_frame, int cached)
 {
@@ -55,25 +62,33 @@ int decode_packet(int *got_frame, int cached)
    
    if (pkt.stream_index == video_stream_idx) {
       // decode video frame 
-      ret = avcodec_decode_video2(video_dec_ctx, frame, got_frame, &pkt);
+      {
+         TraceSpan span("decode", pkt.pts);
+         ret = avcodec_decode_video2(video_dec_ctx, frame, got_frame, &pkt);
+      }
       if (ret < 0) {
          fprintf(stderr, "Error decoding video frame\n");
          return ret;
       }
       
       if (*got_frame) {
-         printf("video_frame%s n:%d coded_n:%d pts:%s\n",
+         fprintf(info, "video_frame%s n:%d coded_n:%d pts:%s\n",
                 cached ? "(cached)" : "",
                 video_frame_count++, frame->coded_picture_number, 0);
 //                av_ts2timestr(frame->pts, &video_dec_ctx->time_base);
          
          // copy decoded frame to destination buffer:
          // this is required since rawvideo expects non aligned data 
-         av_image_copy(video_dst_data, video_dst_linesize,
-                       (const uint8_t **)(frame->data), frame->linesize,
-                       video_dec_ctx->pix_fmt, video_dec_ctx->width, video_dec_ctx->height);
+         int64_t pts = av_frame_get_best_effort_timestamp(frame);
+         {
+            TraceSpan span("copy", pts);
+            av_image_copy(video_dst_data, video_dst_linesize,
+                          (const uint8_t **)(frame->data), frame->linesize,
+                          video_dec_ctx->pix_fmt, video_dec_ctx->width, video_dec_ctx->height);
+         }
          
          // write to rawvideo file 
+         TraceSpan span("write", pts);
          fwrite(video_dst_data[0], 1, video_dst_bufsize, video_dst_file);
       }
    } 
@@ -145,17 +160,30 @@ int get_format_from_sample_fmt(const char **fmt, enum AVSampleFormat sample_fmt)
 int main (int argc, char **argv)
 {
    int ret = 0, got_frame;
+   clock_t start;
+   struct timeval startTime, endTime;
+   int arg = 1;
+   const char *traceFile = NULL;
    
-   if (argc < 3) {
-      fprintf(stderr, "usage: %s input_file video_output_file \n"
+   if (argc > 3 && !strcmp(argv[1], "-trace")) {
+      traceFile = argv[2];
+      arg = 3;
+   }
+   if (argc - arg < 2) {
+      fprintf(stderr, "usage: %s [-trace trace.json] input_file video_output_file \n"
               "API example program to show how to read frames from an input file.\n"
               "This program reads frames from a file, decodes them, and writes decoded\n"
               "video frames to a rawvideo file named video_output_file\n"
+              "Either file can be - to read from stdin or write to stdout.\n"
+              "-trace writes a Chrome trace event timeline of the frames.\n"
               "\n", argv[0]);
       exit(1);
    }
-   src_filename = argv[1];
-   video_dst_filename = argv[2];
+   // libavformat reads pipes through its pipe: protocol
+   src_filename = strcmp(argv[arg], "-") ? argv[arg] : "pipe:0";
+   video_dst_filename = argv[arg + 1];
+   if (!strcmp(video_dst_filename, "-"))
+      info = stderr;
    
    // register all formats and codecs 
    av_register_all();
@@ -172,7 +200,7 @@ int main (int argc, char **argv)
       video_stream = fmt_ctx->streams[video_stream_idx];
       video_dec_ctx = video_stream->codec;
       
-      video_dst_file = fopen(video_dst_filename, "wb");
+      video_dst_file = info == stderr ? stdout : fopen(video_dst_filename, "wb");
       if (!video_dst_file) {
          fprintf(stderr, "Could not open destination file %s\n", video_dst_filename);
          ret = 1;
@@ -212,10 +240,23 @@ int main (int argc, char **argv)
    pkt.size = 0;
    
    if (video_stream)
-      printf("Demuxing video from file '%s' into '%s'\n", src_filename, video_dst_filename);
+      fprintf(info, "Demuxing video from file '%s' into '%s'\n", src_filename, video_dst_filename);
    
+   if (traceFile) {
+      Trace::start();
+      Trace::setThreadName("demuxing");
+   }
+   start = clock();
+   gettimeofday(&startTime, NULL);
+
    // read frames from the file 
-   while (av_read_frame(fmt_ctx, &pkt) >= 0) {
+   for (;;) {
+      {
+         TraceSpan span("read");
+         if (av_read_frame(fmt_ctx, &pkt) < 0)
+            break;
+         span.setPts(pkt.pts);
+      }
       decode_packet(&got_frame, 0);
       av_free_packet(&pkt);
    }
@@ -227,10 +268,18 @@ int main (int argc, char **argv)
       decode_packet(&got_frame, 1);
    } while (got_frame);
    
-   printf("Demuxing succeeded.\n");
+   gettimeofday(&endTime, NULL);
+   if (traceFile)
+      Trace::write(traceFile);
+   {
+      double seconds = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_usec - startTime.tv_usec) / 1e6;
+      fprintf(info, "Demuxing succeeded: %d frames in %.2f s (%.2f s cpu), %.1f MB/s written\n",
+              video_frame_count, seconds, (double)(clock() - start) / CLOCKS_PER_SEC,
+              (double)video_frame_count * video_dst_bufsize / (1024 * 1024) / seconds);
+   }
    
    if (video_stream) {
-      printf("Play the output video file with the command:\n"
+      fprintf(info, "Play the output video file with the command:\n"
              "ffplay -f rawvideo -pix_fmt %s -video_size %dx%d %s\n",
              av_get_pix_fmt_name(video_dec_ctx->pix_fmt), video_dec_ctx->width, video_dec_ctx->height,
              video_dst_filename);
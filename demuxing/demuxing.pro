@@ -5,7 +5,7 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 include(../ff.prf)
+include(../libff/libff.pri)
 
 SOURCES += \
     demuxing.cpp
-
@@ -1,7 +1,16 @@
 TEMPLATE = subdirs
 
 SUBDIRS += \
+    libff \
     muxing \
     demuxing \
     filtering \
-    remuxing
+    remuxing \
+    shmreader \
+    crccompare \
+    thumbnailing
+
+demuxing.depends = libff
+filtering.depends = libff
+remuxing.depends = libff
+thumbnailing.depends = libff
@@ -35,6 +35,8 @@ extern "C" {
 
 }
 
+#include "trace.h"
+
 // 5 seconds stream duration
 #define STREAM_DURATION   200.0
 #define STREAM_FRAME_RATE 25 // 25 images/s
@@ -268,7 +270,7 @@ void write_video_frame(AVFormatContext *_oc, AVStream *st)
 
       pkt.flags        |= AV_PKT_FLAG_KEY;
       pkt.stream_index  = st->index;
-      pkt.data          = _dst_picture.data[0];
+      pkt.data          = (uint8_t *)&_dst_picture;
       pkt.size          = sizeof(AVPicture);
 
       ret = av_interleaved_write_frame(_oc, &pkt);
@@ -282,7 +284,10 @@ void write_video_frame(AVFormatContext *_oc, AVStream *st)
       pkt.data = NULL;    // packet data will be allocated by the encoder
       pkt.size = 0;
 
-      ret = avcodec_encode_video2(c, &pkt, _frame, &got_output);
+      {
+         TraceSpan span("encode", _frame->pts);
+         ret = avcodec_encode_video2(c, &pkt, _frame, &got_output);
+      }
       if (ret < 0)
          throw std::runtime_error("Error encoding video _frame");
 
@@ -293,6 +298,7 @@ void write_video_frame(AVFormatContext *_oc, AVStream *st)
          pkt.stream_index = st->index;
 
          // Write the compressed _frame to the media file.
+         TraceSpan span("write", pkt.pts);
          ret = av_interleaved_write_frame(_oc, &pkt);
       }
       else
@@ -325,6 +331,8 @@ try
    int ret;
    AVFormatContext *_oc;
    AVStream *_video_st;
+   int arg(1);
+   const char *traceFile(NULL);
 
    _frame = avcodec_alloc_frame();
 
@@ -332,21 +340,31 @@ try
       perror("Could not allocate _frame");
       exit(1);
    }
-   if (argc < 2) {
-      fprintf(stderr, "Usage: %s file\n", argv[0]);
+   if (argc > 3 && !strcmp(argv[1], "-trace")) {
+      traceFile = argv[2];
+      arg = 3;
+   }
+   if (argc - arg < 2) {
+      fprintf(stderr, "Usage: %s [-trace trace.json] input_file|- output_file|-\n", argv[0]);
       exit(1);
    }
+   if (traceFile) {
+      Trace::start();
+      Trace::setThreadName("filtering");
+   }
    
    avcodec_register_all();
    av_register_all();
    avfilter_register_all();
    
-   if ((ret = openInputFile(argv[1])) < 0)
+   // libavformat reads and writes pipes through its pipe: protocol; the raw
+   // dnxhd output never seeks, so it streams as is
+   if ((ret = openInputFile(strcmp(argv[arg], "-") ? argv[arg] : "pipe:0")) < 0)
       goto end;
    if ((ret = initFilters(_filterDescr)) < 0)
       goto end;
 
-   _filename = argv[2];
+   _filename = strcmp(argv[arg + 1], "-") ? argv[arg + 1] : "pipe:1";
 //   _fmt = av_guess_format("mov", NULL, NULL);
 //   _fmt->video_codec = AV_CODEC_ID_DNXHD;
    // allocate the output media context
@@ -391,13 +409,20 @@ try
    // read all packets
    while (1) {
       AVFilterBufferRef *picref;
-      if ((ret = av_read_frame(_fmtCtx, &packet)) < 0)
-         break;
+      {
+         TraceSpan span("read");
+         if ((ret = av_read_frame(_fmtCtx, &packet)) < 0)
+            break;
+         span.setPts(packet.pts);
+      }
       
       if (packet.stream_index == _videoStreamIndex) {
          avcodec_get_frame_defaults(_frame);
          _got_frame = 0;
-         ret = avcodec_decode_video2(_decCtx, _frame, &_got_frame, &packet);
+         {
+            TraceSpan span("decode", packet.pts);
+            ret = avcodec_decode_video2(_decCtx, _frame, &_got_frame, &packet);
+         }
          if (ret < 0) {
             av_log(NULL, AV_LOG_ERROR, "Error decoding video\n");
             break;
@@ -407,14 +432,23 @@ try
             _frame->pts = av_frame_get_best_effort_timestamp(_frame);
             
             // push the decoded _frame into the filtergraph
-            if (av_buffersrc_add_frame(_bufferSrcCtx, _frame, 0) < 0) {
+            {
+               TraceSpan span("filter", _frame->pts);
+               ret = av_buffersrc_add_frame(_bufferSrcCtx, _frame, 0);
+            }
+            if (ret < 0) {
                av_log(NULL, AV_LOG_ERROR, "Error while feeding the filtergraph\n");
                break;
             }
             
             // pull filtered pictures from the filtergraph 
             while (1) {
-               ret = av_buffersink_get_buffer_ref(_bufferSinkCtx, &picref, 0);
+               {
+                  TraceSpan span("filter");
+                  ret = av_buffersink_get_buffer_ref(_bufferSinkCtx, &picref, 0);
+                  if (ret >= 0 && picref)
+                     span.setPts(picref->pts);
+               }
                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
                   break;
                if (ret < 0)
@@ -437,6 +471,8 @@ try
    }
 
 end:
+   if (traceFile)
+      Trace::write(traceFile);
    avfilter_graph_free(&_filterGraph);
    if (_decCtx)
       avcodec_close(_decCtx);
@@ -4,7 +4,7 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 include(../ff.prf)
+include(../libff/libff.pri)
 
 SOURCES += \
     filtering.cpp
-
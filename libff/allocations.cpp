@@ -0,0 +1,92 @@
+#include "allocations.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+
+// glibc's own allocator, which the wrappers forward to
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void __libc_free(void *pointer);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+// Plain thread locals: no constructor runs on first use, malloc may be
+// called before anything else on a new thread.
+static __thread bool counting;
+static __thread int64_t allocations;
+
+Allocations::Scope::Scope(bool on)
+: _previous(counting)
+{
+   counting = on;
+}
+
+Allocations::Scope::~Scope()
+{
+   counting = _previous;
+}
+
+int64_t Allocations::counted()
+{
+   return allocations;
+}
+
+static inline void countAllocation(size_t size)
+{
+   if (counting && size)
+      ++allocations;
+}
+
+extern "C" {
+
+void *malloc(size_t size) throw()
+{
+   countAllocation(size);
+   return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) throw()
+{
+   countAllocation(count * size);
+   return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) throw()
+{
+   countAllocation(size);
+   return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) throw()
+{
+   __libc_free(pointer);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size) throw()
+{
+   if (!alignment || (alignment & (alignment - 1)) || alignment % sizeof(void*))
+      return EINVAL;
+   countAllocation(size);
+   void *memory = __libc_memalign(alignment, size);
+   if (!memory && size)
+      return ENOMEM;
+   *pointer = memory;
+   return 0;
+}
+
+void *memalign(size_t alignment, size_t size) throw()
+{
+   countAllocation(size);
+   return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) throw()
+{
+   countAllocation(size);
+   return __libc_memalign(alignment, size);
+}
+
+}
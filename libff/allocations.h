@@ -0,0 +1,31 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include <cstdint>
+
+// Counts the heap allocations a thread makes while a Scope is open: malloc,
+// calloc, realloc, posix_memalign, memalign and aligned_alloc, which
+// av_malloc and operator new end in. libff replaces these C library entry
+// points with wrappers that forward to glibc; outside a Scope a wrapper
+// costs one thread local test.
+namespace Allocations
+{
+   // Counts on the calling thread for its lifetime, or pauses counting with
+   // counting false. Scopes nest.
+   class Scope
+   {
+   public:
+      explicit Scope(bool counting = true);
+      ~Scope();
+
+   private:
+      Scope(const Scope&);
+      Scope& operator=(const Scope&);
+      bool _previous;
+   };
+
+   // allocations counted on the calling thread so far
+   int64_t counted();
+}
+
+#endif // ALLOCATIONS_H
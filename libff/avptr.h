@@ -0,0 +1,135 @@
+#ifndef AVPTR_H
+#define AVPTR_H
+
+#include "libav.h"
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Owners for the libav objects, so a constructor that throws halfway or an
+// early return releases everything acquired so far. Long-running processes
+// open and close thousands of inputs; a context lost per job adds up.
+//
+// Members holding these are destroyed in reverse order of declaration: an
+// OpenCodecPtr must come after the format context that owns its codec context,
+// a format context after the StreamIO its pb points into.
+
+struct InputFormatCloser
+{
+   void operator()(AVFormatContext *ctx) const { avformat_close_input(&ctx); }
+};
+
+// Closes the output file unless the caller supplied the AVIOContext
+// (AVFMT_FLAG_CUSTOM_IO), then frees the context and its streams.
+struct OutputFormatCloser
+{
+   void operator()(AVFormatContext *ctx) const
+   {
+      if (ctx->pb && !(ctx->flags & AVFMT_FLAG_CUSTOM_IO)
+          && ctx->oformat && !(ctx->oformat->flags & AVFMT_NOFILE))
+         avio_close(ctx->pb);
+      avformat_free_context(ctx);
+   }
+};
+
+// A codec context opened with avcodec_open2 that belongs to a stream: only
+// closed, the format context frees it.
+struct CodecCloser
+{
+   void operator()(AVCodecContext *ctx) const { avcodec_close(ctx); }
+};
+
+// A codec context of our own, from avcodec_alloc_context3: closed and freed.
+struct CodecContextFree
+{
+   void operator()(AVCodecContext *ctx) const { avcodec_close(ctx); av_free(ctx); }
+};
+
+struct FilterGraphFree
+{
+   void operator()(AVFilterGraph *graph) const { avfilter_graph_free(&graph); }
+};
+
+struct FilterInOutFree
+{
+   void operator()(AVFilterInOut *inOut) const { avfilter_inout_free(&inOut); }
+};
+
+struct BufferRefUnref
+{
+   void operator()(AVFilterBufferRef *ref) const { avfilter_unref_bufferp(&ref); }
+};
+
+struct SwsFree
+{
+   void operator()(struct SwsContext *ctx) const { sws_freeContext(ctx); }
+};
+
+struct FrameFree
+{
+   void operator()(AVFrame *frame) const { avcodec_free_frame(&frame); }
+};
+
+struct AvFree
+{
+   void operator()(void *ptr) const { av_free(ptr); }
+};
+
+typedef std::unique_ptr<AVFormatContext, InputFormatCloser> InputFormatPtr;
+typedef std::unique_ptr<AVFormatContext, OutputFormatCloser> OutputFormatPtr;
+typedef std::unique_ptr<AVCodecContext, CodecCloser> OpenCodecPtr;
+typedef std::unique_ptr<AVCodecContext, CodecContextFree> CodecContextPtr;
+typedef std::unique_ptr<AVFilterGraph, FilterGraphFree> FilterGraphPtr;
+typedef std::unique_ptr<AVFilterInOut, FilterInOutFree> FilterInOutPtr;
+typedef std::unique_ptr<AVFilterBufferRef, BufferRefUnref> BufferRefPtr;
+typedef std::unique_ptr<struct SwsContext, SwsFree> SwsContextPtr;
+typedef std::unique_ptr<AVFrame, FrameFree> FramePtr;
+template <class T> using AvMallocPtr = std::unique_ptr<T, AvFree>;
+
+inline FramePtr allocFrame()
+{
+   FramePtr frame(avcodec_alloc_frame());
+   if (!frame)
+      throw std::runtime_error("Could not allocate frame");
+   return frame;
+}
+
+// An AVPacket that frees its payload when it goes out of scope or is reset.
+class Packet
+{
+public:
+   Packet() { init(); }
+   ~Packet() { av_free_packet(&_packet); }
+
+   AVPacket *get() { return &_packet; }
+   AVPacket *operator->() { return &_packet; }
+   AVPacket& operator*() { return _packet; }
+   const AVPacket *operator->() const { return &_packet; }
+   // frees the payload, the packet is empty again
+   void reset() { av_free_packet(&_packet); init(); }
+   // hands the payload over to the caller, the packet is empty again
+   AVPacket release() { AVPacket packet = _packet; init(); return packet; }
+
+private:
+   Packet(const Packet&);
+   Packet& operator=(const Packet&);
+   void init() { av_init_packet(&_packet); _packet.data = NULL; _packet.size = 0; }
+
+   AVPacket _packet;
+};
+
+// A packet kept past the next read and shared by whoever writes it.
+typedef std::shared_ptr<AVPacket> PacketRef;
+typedef std::vector<PacketRef> PacketRefs;
+
+// Takes the payload of packet, copied first if it points into demuxer
+// memory that the next read reuses.
+inline PacketRef sharePacket(Packet& packet)
+{
+   if (av_dup_packet(packet.get()) < 0)
+      throw std::runtime_error("Could not allocate packet");
+   return PacketRef(new AVPacket(packet.release()), [](AVPacket *pkt) { av_free_packet(pkt); delete pkt; });
+}
+
+#endif // AVPTR_H
@@ -0,0 +1,101 @@
+#include "bandpass.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+BandPass::BandPass(int width, int height, enum AVPixelFormat srcFmt,
+                   int dstWidth, int dstHeight, enum AVPixelFormat dstFmt,
+                   int swsFlags, int cacheBytes)
+: _width(width)
+, _height(height)
+, _srcFmt(srcFmt)
+, _dstWidth(dstWidth)
+, _dstHeight(dstHeight)
+, _dstFmt(dstFmt)
+{
+   const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(srcFmt);
+   if (!desc)
+      throw std::runtime_error("Unknown band pass source format");
+   _chromaShift = desc->log2_chroma_h;
+
+   if (av_image_fill_linesizes(_rowBytes, srcFmt, width) < 0)
+      throw std::runtime_error("Could not compute band pass line sizes");
+   _srcFrameBytes = avpicture_get_size(srcFmt, width, height);
+   _dstFrameBytes = avpicture_get_size(dstFmt, dstWidth, dstHeight);
+
+   // A band holds its source rows in the scratch strip plus the destination
+   // rows they produce; size it so both fit in cacheBytes, in whole chroma rows.
+   int64_t bytesPerRow = (_srcFrameBytes + _dstFrameBytes) / height + 1;
+   int rows = cacheBytes > 0 ? cacheBytes / bytesPerRow : height;
+   int align = 1 << _chromaShift;
+   _bandHeight = std::min(height, std::max(align, rows / align * align));
+
+   if (av_image_alloc(_band, _bandLinesizes, width, _bandHeight, srcFmt, 32) < 0)
+      throw std::runtime_error("Could not allocate band buffer");
+   _bandBuffer.reset(_band[0]);
+
+   if (srcFmt != dstFmt || width != dstWidth || height != dstHeight) {
+      _swsCtx.reset(sws_getContext(width, height, srcFmt, dstWidth, dstHeight, dstFmt,
+                                   swsFlags, NULL, NULL, NULL));
+      if (!_swsCtx)
+         throw std::runtime_error("Could not initialize the conversion context\n");
+   }
+}
+
+void BandPass::copyBand(const uint8_t *const src[4], const int srcLinesizes[4],
+                        uint8_t *const dst[4], const int dstLinesizes[4], int y, int height)
+{
+   for (int plane(0); plane < 4 && _rowBytes[plane]; ++plane) {
+      // planes 1 and 2 are the chroma planes, alpha is full height
+      int shift = (plane == 1 || plane == 2) ? _chromaShift : 0;
+      // the band buffer only holds the current band, frames are addressed by row
+      int row = y >> shift;
+      int srcRow = src == _band ? 0 : row;
+      int dstRow = dst == _band ? 0 : row;
+      av_image_copy_plane(dst[plane] + dstRow * dstLinesizes[plane], dstLinesizes[plane],
+                          src[plane] + srcRow * srcLinesizes[plane], srcLinesizes[plane],
+                          _rowBytes[plane], -((-height) >> shift));
+   }
+}
+
+void BandPass::run(const uint8_t *const src[4], const int srcLinesizes[4],
+                   uint8_t *const dst[4], const int dstLinesizes[4], double time)
+{
+   for (int y(0); y < _height; y += _bandHeight) {
+      int height = std::min(_bandHeight, _height - y);
+
+      copyBand(src, srcLinesizes, _band, _bandLinesizes, y, height);
+
+      for (auto stage(_stages.begin()); stage != _stages.end(); ++stage)
+         (*stage)(_band, _bandLinesizes, _width, y, height, time);
+
+      // sws_scale keeps the vertical filter state between consecutive slices
+      if (_swsCtx)
+         sws_scale(_swsCtx.get(), (const uint8_t * const *)_band, _bandLinesizes, y, height,
+                   dst, dstLinesizes);
+      else
+         copyBand(_band, _bandLinesizes, dst, dstLinesizes, y, height);
+   }
+   ++_frames;
+}
+
+int64_t BandPass::bytesPerFrame() const
+{
+   if (_bandHeight < _height)
+      // if the band strip stays cache resident: source read once, destination written once
+      return _srcFrameBytes + _dstFrameBytes;
+   return unfusedBytesPerFrame();
+}
+
+int64_t BandPass::unfusedBytesPerFrame() const
+{
+   // copy (read + write), every stage (read + write), conversion (read + write)
+   return 2 * _srcFrameBytes
+         + 2 * _srcFrameBytes * (int64_t)_stages.size()
+         + _srcFrameBytes + _dstFrameBytes;
+}
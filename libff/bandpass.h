@@ -0,0 +1,71 @@
+#ifndef BANDPASS_H
+#define BANDPASS_H
+
+#include "avptr.h"
+#include "libav.h"
+
+#include <functional>
+#include <vector>
+
+// Fused per-frame pixel pass. Instead of copying, processing and converting
+// the whole frame one step after the other, the frame is walked once in
+// horizontal bands small enough to stay in cache: every band is copied into
+// a scratch strip, run through the user stages and packed into the
+// destination format before the next band is touched.
+class BandPass
+{
+public:
+   // Processes rows [y, y + height) of the frame held in the band buffer;
+   // time is the presentation time of the frame, for per-frame corrections.
+   typedef std::function<void(uint8_t *const *rows, const int *linesizes,
+                              int width, int y, int height, double time)> Stage;
+
+   // cacheBytes bounds the working set of one band; 0 processes the frame as
+   // a single band, which is the unfused behaviour.
+   BandPass(int width, int height, enum AVPixelFormat srcFmt,
+            int dstWidth, int dstHeight, enum AVPixelFormat dstFmt,
+            int swsFlags, int cacheBytes = CACHE_BYTES);
+
+   void addStage(const Stage& stage) { _stages.push_back(stage); }
+   void run(const uint8_t *const src[4], const int srcLinesizes[4],
+            uint8_t *const dst[4], const int dstLinesizes[4], double time = 0.);
+
+   int bandHeight() const { return _bandHeight; }
+   int64_t frames() const { return _frames; }
+   // Main memory traffic per frame of this pass, and of the same steps done
+   // as separate full-frame passes. A model, not a measurement: it assumes a
+   // band stays in cache between steps and a full frame does not. The LLC
+   // misses of the convert stage of Muxer::perfStats measure it.
+   int64_t bytesPerFrame() const;
+   int64_t unfusedBytesPerFrame() const;
+
+   static const int CACHE_BYTES = 256 * 1024;
+
+private:
+   BandPass(const BandPass&);
+   BandPass& operator=(const BandPass&);
+   void copyBand(const uint8_t *const src[4], const int srcLinesizes[4],
+                 uint8_t *const dst[4], const int dstLinesizes[4], int y, int height);
+
+   int _width;
+   int _height;
+   enum AVPixelFormat _srcFmt;
+   int _dstWidth;
+   int _dstHeight;
+   enum AVPixelFormat _dstFmt;
+   int _bandHeight = 0;
+   int _chromaShift = 0;
+   int _rowBytes[4];
+
+   SwsContextPtr _swsCtx;
+   uint8_t *_band[4] = {nullptr};
+   AvMallocPtr<uint8_t> _bandBuffer;
+   int _bandLinesizes[4];
+   std::vector<Stage> _stages;
+
+   int64_t _srcFrameBytes = 0;
+   int64_t _dstFrameBytes = 0;
+   int64_t _frames = 0;
+};
+
+#endif // BANDPASS_H
@@ -0,0 +1,80 @@
+#include "cancel.h"
+
+CancelToken::CancelToken()
+: _cancelled(false)
+, _deadline(0)
+{
+}
+
+CancelToken::CancelToken(std::shared_ptr<const CancelToken> parent)
+: _parent(parent)
+, _cancelled(false)
+, _deadline(0)
+{
+}
+
+bool CancelToken::cancelled() const
+{
+   if (_cancelled || (_parent && _parent->cancelled()))
+      return true;
+   Clock::rep deadline = _deadline;
+   return deadline && Clock::now().time_since_epoch().count() >= deadline;
+}
+
+void CancelToken::check(const char *what) const
+{
+   if (cancelled())
+      throw Cancelled(std::string("Cancelled while ") + what);
+}
+
+IoInterrupt::IoInterrupt(std::shared_ptr<CancelToken> token, int timeoutMs)
+: _token(token)
+, _timeoutMs(timeoutMs)
+, _deadline(0)
+, _timedOut(false)
+{
+}
+
+AVIOInterruptCB IoInterrupt::callback()
+{
+   AVIOInterruptCB callback = { &IoInterrupt::poll, this };
+   return callback;
+}
+
+bool IoInterrupt::interrupted() const
+{
+   if (_token && _token->cancelled())
+      return true;
+   Clock::rep deadline = _deadline;
+   if (deadline && Clock::now().time_since_epoch().count() >= deadline) {
+      _timedOut = true;
+      return true;
+   }
+   return false;
+}
+
+void IoInterrupt::check(const char *what) const
+{
+   if (_timedOut)
+      throw Cancelled(std::string("Timed out ") + what + " after " + std::to_string(_timeoutMs) + " ms");
+   checkToken(what);
+}
+
+int IoInterrupt::poll(void *opaque)
+{
+   return static_cast<IoInterrupt*>(opaque)->interrupted();
+}
+
+IoInterrupt::Operation::Operation(IoInterrupt& interrupt)
+: _interrupt(interrupt)
+{
+   _interrupt._timedOut = false;
+   if (_interrupt._timeoutMs > 0)
+      _interrupt._deadline = (Clock::now() + std::chrono::milliseconds(_interrupt._timeoutMs))
+                             .time_since_epoch().count();
+}
+
+IoInterrupt::Operation::~Operation()
+{
+   _interrupt._deadline = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include "latency.h"
+#include "libav.h"
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Thrown by a stage that stopped because its job was cancelled or one of
+// its I/O operations ran past its timeout.
+class Cancelled : public std::runtime_error
+{
+public:
+   explicit Cancelled(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Shared by the stages of one job. cancel() may be called from any thread
+// and from a signal handler; every stage notices within CancelToken::BOUND_MS
+// plus the frame it is working on, then releases what it holds on the way
+// out of its owner's scope. A token with a parent is cancelled with it too,
+// e.g. the jobs of a daemon with the daemon.
+class CancelToken
+{
+public:
+   // how often the blocking waits of the stages look at the token
+   static const int BOUND_MS = 100;
+
+   CancelToken();
+   explicit CancelToken(std::shared_ptr<const CancelToken> parent);
+   void cancel() { _cancelled = true; }
+   // cancelled once this point has passed
+   void setDeadline(Clock::time_point deadline) { _deadline = deadline.time_since_epoch().count(); }
+   bool cancelled() const;
+   // throws Cancelled when cancelled, what names the interrupted step
+   void check(const char *what) const;
+
+private:
+   CancelToken(const CancelToken&);
+   CancelToken& operator=(const CancelToken&);
+
+   std::shared_ptr<const CancelToken> _parent;
+   std::atomic<bool> _cancelled;
+   // time_since_epoch ticks, 0 for none
+   std::atomic<Clock::rep> _deadline;
+};
+
+// The AVIO interrupt callback of one format context. libav polls it while
+// it waits on I/O and gives up with AVERROR_EXIT once the token is cancelled
+// or the current operation has taken longer than timeoutMs.
+class IoInterrupt
+{
+public:
+   IoInterrupt(std::shared_ptr<CancelToken> token, int timeoutMs);
+   AVIOInterruptCB callback();
+   bool interrupted() const;
+   // After a failed libav call: throws Cancelled when we interrupted it.
+   void check(const char *what) const;
+   // Between operations: throws Cancelled when the job is cancelled.
+   void checkToken(const char *what) const { if (_token) _token->check(what); }
+
+   // Times one blocking libav call.
+   class Operation
+   {
+   public:
+      explicit Operation(IoInterrupt& interrupt);
+      ~Operation();
+
+   private:
+      IoInterrupt& _interrupt;
+   };
+
+private:
+   IoInterrupt(const IoInterrupt&);
+   IoInterrupt& operator=(const IoInterrupt&);
+   static int poll(void *opaque);
+
+   std::shared_ptr<CancelToken> _token;
+   const int _timeoutMs;
+   std::atomic<Clock::rep> _deadline;
+   mutable std::atomic<bool> _timedOut;
+};
+
+#endif // CANCEL_H
@@ -0,0 +1,272 @@
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+void Checkpoint::save(const std::string& path) const
+{
+   // written aside and renamed over the previous one: a crash while saving
+   // leaves that one intact
+   std::string temporary = path + ".tmp";
+   FILE *file = fopen(temporary.c_str(), "w");
+   if (!file)
+      throw std::runtime_error("Could not write checkpoint " + temporary + ": " + strerror(errno));
+   fprintf(file, "#checkpoint\n");
+   fprintf(file, "offset %lld\n", (long long)offset);
+   fprintf(file, "frames %lld\n", (long long)frames);
+   fprintf(file, "next_pts %lld\n", (long long)nextPts);
+   fprintf(file, "filter_pts %lld\n", (long long)filterPts);
+   fprintf(file, "input_frame %lld\n", (long long)inputFrame);
+   fprintf(file, "input_pts %lld\n", (long long)inputPts);
+   fprintf(file, "first_dts");
+   for (auto dts(firstDts.begin()); dts != firstDts.end(); ++dts)
+      fprintf(file, " %lld", (long long)*dts);
+   fprintf(file, "\n");
+   bool failed = fflush(file) != 0 || fsync(fileno(file)) != 0;
+   failed |= fclose(file) != 0;
+   if (failed || rename(temporary.c_str(), path.c_str()) < 0)
+      throw std::runtime_error("Could not write checkpoint " + path + ": " + strerror(errno));
+}
+
+Checkpoint Checkpoint::load(const std::string& path)
+{
+   std::ifstream in(path.c_str());
+   if (!in)
+      throw std::runtime_error("Could not open checkpoint " + path);
+   Checkpoint checkpoint;
+   bool found(false);
+   std::string line;
+   while (std::getline(in, line)) {
+      if (line.empty() || line[0] == '#')
+         continue;
+      std::istringstream fields(line);
+      std::string key;
+      long long value;
+      fields >>key;
+      if (key == "first_dts") {
+         while (fields >>value)
+            checkpoint.firstDts.push_back(value);
+         continue;
+      }
+      if (!(fields >>value))
+         throw std::runtime_error(path + ": not a checkpoint line: " + line);
+      if (key == "offset") {
+         checkpoint.offset = value;
+         found = true;
+      }
+      else if (key == "frames")
+         checkpoint.frames = value;
+      else if (key == "next_pts")
+         checkpoint.nextPts = value;
+      else if (key == "filter_pts")
+         checkpoint.filterPts = value;
+      else if (key == "input_frame")
+         checkpoint.inputFrame = value;
+      else if (key == "input_pts")
+         checkpoint.inputPts = value;
+   }
+   if (!found || checkpoint.offset <= 0)
+      throw std::runtime_error(path + " is not a checkpoint");
+   return checkpoint;
+}
+
+OutputReplay::OutputReplay(const char *path, int64_t size)
+: _path(path)
+, _size(size)
+{
+   _fd = open(path, O_RDONLY);
+   if (_fd < 0)
+      throw std::runtime_error(_path + ": " + strerror(errno));
+   off_t end = lseek(_fd, 0, SEEK_END);
+   if (end < size) {
+      release();
+      throw std::runtime_error(_path + " is shorter than its checkpoint");
+   }
+   try {
+      findFragments();
+   }
+   catch (...) {
+      release();
+      throw;
+   }
+
+   unsigned char *buffer = static_cast<unsigned char*>(av_malloc(BUFFER_SIZE));
+   if (buffer)
+      _inputIo = avio_alloc_context(buffer, BUFFER_SIZE, 0, this, &OutputReplay::readInput, NULL,
+                                    &OutputReplay::seekInput);
+   if (!_inputIo)
+      av_free(buffer);
+   buffer = static_cast<unsigned char*>(av_malloc(BUFFER_SIZE));
+   if (buffer)
+      _sinkIo = avio_alloc_context(buffer, BUFFER_SIZE, 1, this, NULL, &OutputReplay::writeSink,
+                                   &OutputReplay::seekSink);
+   if (!_sinkIo)
+      av_free(buffer);
+   AVFormatContext *input = avformat_alloc_context();
+   if (!_inputIo || !_sinkIo || !input) {
+      avformat_free_context(input);
+      release();
+      throw std::runtime_error("Could not allocate the output replay");
+   }
+   input->pb = _inputIo;
+   input->flags |= AVFMT_FLAG_CUSTOM_IO;
+   // avformat_open_input frees the context when it fails
+   if (avformat_open_input(&input, path, NULL, NULL) < 0) {
+      release();
+      throw std::runtime_error(_path + ": could not read back the output");
+   }
+   _input.reset(input);
+}
+
+OutputReplay::~OutputReplay()
+{
+   release();
+}
+
+void OutputReplay::release()
+{
+   // the demuxer before the context it reads from
+   _input.reset();
+   if (_inputIo) {
+      av_freep(&_inputIo->buffer);
+      av_freep(&_inputIo);
+   }
+   if (_sinkIo) {
+      av_freep(&_sinkIo->buffer);
+      av_freep(&_sinkIo);
+   }
+   if (_fd >= 0)
+      ::close(_fd);
+   _fd = -1;
+}
+
+// The top level boxes of a fragmented mov are ftyp, moov, then a moof and an
+// mdat per fragment.
+void OutputReplay::findFragments()
+{
+   for (int64_t pos(0); pos + 8 <= _size; ) {
+      uint8_t header[16];
+      if (pread(_fd, header, sizeof(header), pos) < 8)
+         break;
+      int64_t size = (int64_t)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+      if (size == 1) {
+         size = 0;
+         for (int i(8); i < 16; ++i)
+            size = size << 8 | header[i];
+      }
+      else if (size == 0)
+         size = _size - pos;
+      if (size < 8)
+         throw std::runtime_error(_path + ": broken box at " + std::to_string(pos));
+      if (!memcmp(header + 4, "mdat", 4))
+         _fragments.push_back(pos);
+      pos += size;
+   }
+}
+
+bool OutputReplay::read(Packet& packet, bool& fragment)
+{
+   packet.reset();
+   if (av_read_frame(_input.get(), packet.get()) < 0)
+      return false;
+   int current = std::upper_bound(_fragments.begin(), _fragments.end(), packet->pos) - _fragments.begin() - 1;
+   fragment = _fragment >= 0 && current != _fragment;
+   _fragment = current;
+   return true;
+}
+
+void OutputReplay::verify()
+{
+   avio_flush(_sinkIo);
+   if (_mismatch >= 0)
+      throw std::runtime_error(_path + " differs from its replay at byte " + std::to_string(_mismatch)
+                               + ", the output or the options changed since the checkpoint");
+   if (_sinkEnd != _size)
+      throw std::runtime_error(_path + ": the replay wrote " + std::to_string(_sinkEnd) + " bytes, the checkpoint has "
+                               + std::to_string(_size));
+}
+
+int OutputReplay::readInput(void *opaque, uint8_t *buf, int size)
+{
+   OutputReplay *replay = static_cast<OutputReplay*>(opaque);
+   size = std::min<int64_t>(size, replay->_size - replay->_inputPos);
+   if (size <= 0)
+      return AVERROR_EOF;
+   ssize_t ret = pread(replay->_fd, buf, size, replay->_inputPos);
+   if (ret < 0)
+      return AVERROR(errno);
+   if (ret == 0)
+      return AVERROR_EOF;
+   replay->_inputPos += ret;
+   return ret;
+}
+
+int64_t OutputReplay::seekInput(void *opaque, int64_t offset, int whence)
+{
+   OutputReplay *replay = static_cast<OutputReplay*>(opaque);
+   // only the replayed part of the file is there to read
+   if (whence == AVSEEK_SIZE)
+      return replay->_size;
+   if (whence == SEEK_CUR)
+      offset += replay->_inputPos;
+   else if (whence == SEEK_END)
+      offset += replay->_size;
+   else if (whence != SEEK_SET)
+      return AVERROR(EINVAL);
+   if (offset < 0)
+      return AVERROR(EINVAL);
+   return replay->_inputPos = offset;
+}
+
+int OutputReplay::writeSink(void *opaque, uint8_t *buf, int size)
+{
+   OutputReplay *replay = static_cast<OutputReplay*>(opaque);
+   if (replay->_mismatch < 0) {
+      uint8_t expected[64 * 1024];
+      for (int done(0); done < size; ) {
+         int chunk = std::min<int64_t>(std::min<int>(size - done, sizeof(expected)),
+                                       replay->_size - replay->_sinkPos - done);
+         ssize_t ret = chunk > 0 ? pread(replay->_fd, expected, chunk, replay->_sinkPos + done) : 0;
+         if (ret <= 0) {
+            // past the checkpoint
+            replay->_mismatch = replay->_sinkPos + done;
+            break;
+         }
+         const uint8_t *mismatch = std::mismatch(buf + done, buf + done + ret, expected).first;
+         if (mismatch != buf + done + ret) {
+            replay->_mismatch = replay->_sinkPos + (mismatch - buf);
+            break;
+         }
+         done += ret;
+      }
+   }
+   replay->_sinkPos += size;
+   replay->_sinkEnd = std::max(replay->_sinkEnd, replay->_sinkPos);
+   return size;
+}
+
+int64_t OutputReplay::seekSink(void *opaque, int64_t offset, int whence)
+{
+   OutputReplay *replay = static_cast<OutputReplay*>(opaque);
+   // what is written after a seek is checked at its new place
+   if (whence == AVSEEK_SIZE)
+      return replay->_sinkEnd;
+   if (whence == SEEK_CUR)
+      offset += replay->_sinkPos;
+   else if (whence == SEEK_END)
+      offset += replay->_sinkEnd;
+   else if (whence != SEEK_SET)
+      return AVERROR(EINVAL);
+   if (offset < 0)
+      return AVERROR(EINVAL);
+   return replay->_sinkPos = offset;
+}
@@ -0,0 +1,81 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "avptr.h"
+#include "libav.h"
+
+#include <string>
+#include <vector>
+
+// Where a job can take an output up again after a crash. The Muxer saves one
+// each time it closes a fragment at a checkpoint, replacing the previous one
+// with a single rename. Text, one "key value" line per field.
+struct Checkpoint
+{
+   // the output up to here is final: the header and whole fragments
+   int64_t offset = 0;
+   // frame slots written, and the pts of the next frame in the video stream
+   // time base
+   int64_t frames = 0;
+   int64_t nextPts = 0;
+   // filter output pts of the last frame written
+   int64_t filterPts = AV_NOPTS_VALUE;
+   // input frame number and pts the filter graph is rebuilt from, see
+   // Filter::resumeFrom
+   int64_t inputFrame = 0;
+   int64_t inputPts = AV_NOPTS_VALUE;
+   // dts of the first packet of each output stream, in the stream time base
+   std::vector<int64_t> firstDts;
+
+   void save(const std::string& path) const;
+   static Checkpoint load(const std::string& path);
+};
+
+// Reads back the first size bytes of a fragmented mov output, so that a new
+// muxer reaches the state the one that wrote them had: read() hands out the
+// packets in the order they were written and tells where each fragment
+// starts, sink() takes what the new muxer writes and checks it against the
+// file.
+class OutputReplay
+{
+public:
+   OutputReplay(const char *path, int64_t size);
+   virtual ~OutputReplay();
+   // the output context of the muxer until the replay is verified
+   AVIOContext *sink() { return _sinkIo; }
+   const AVFormatContext *input() const { return _input.get(); }
+   // The next packet of the output, false after the last one. fragment is set
+   // when the packet starts a fragment, except for the first one.
+   bool read(Packet& packet, bool& fragment);
+   // Throws unless the sink got the replayed size bytes again, byte for byte.
+   void verify();
+
+private:
+   OutputReplay(const OutputReplay&);
+   OutputReplay& operator=(const OutputReplay&);
+   void release();
+   void findFragments();
+   static int readInput(void *opaque, uint8_t *buf, int size);
+   static int64_t seekInput(void *opaque, int64_t offset, int whence);
+   static int writeSink(void *opaque, uint8_t *buf, int size);
+   static int64_t seekSink(void *opaque, int64_t offset, int whence);
+
+   const int BUFFER_SIZE = 256 * 1024;
+
+   std::string _path;
+   int _fd = -1;
+   const int64_t _size;
+   int64_t _inputPos = 0;
+   int64_t _sinkPos = 0;
+   int64_t _sinkEnd = 0;
+   // first byte the sink got differently, -1 for none
+   int64_t _mismatch = -1;
+   AVIOContext *_inputIo = nullptr;
+   AVIOContext *_sinkIo = nullptr;
+   InputFormatPtr _input;
+   // file offsets of the mdat boxes, one per fragment
+   std::vector<int64_t> _fragments;
+   int _fragment = -1;
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,139 @@
+#include "checksum.h"
+
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+typedef uint32_t (*Crc32c)(uint32_t crc, const uint8_t *data, size_t size);
+
+// reflected Castagnoli polynomial
+static const uint32_t POLY = 0x82f63b78;
+static uint32_t table[8][256];
+
+static void initTable()
+{
+   for (uint32_t n(0); n < 256; ++n) {
+      uint32_t c = n;
+      for (int k(0); k < 8; ++k)
+         c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+      table[0][n] = c;
+   }
+   // table[k][n]: n followed by k zero bytes, for 8 bytes per step
+   for (uint32_t n(0); n < 256; ++n)
+      for (int k(1); k < 8; ++k)
+         table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xff];
+}
+
+static uint32_t crc32cTable(uint32_t crc, const uint8_t *data, size_t size)
+{
+   uint32_t c = ~crc;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   for (; size >= 8; size -= 8, data += 8) {
+      uint64_t word;
+      memcpy(&word, data, sizeof(word));
+      word ^= c;
+      c = table[7][word & 0xff] ^ table[6][(word >> 8) & 0xff]
+        ^ table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff]
+        ^ table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff]
+        ^ table[1][(word >> 48) & 0xff] ^ table[0][word >> 56];
+   }
+#endif
+   for (; size; --size)
+      c = (c >> 8) ^ table[0][(c ^ *data++) & 0xff];
+   return ~c;
+}
+
+#ifdef CRC32C_SSE42
+// One crc32 instruction per 8 bytes. Built for SSE4.2 whatever the compiler
+// flags, only called once the CPU is known to have it.
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t size)
+{
+   uint32_t c = ~crc;
+   for (; size && (reinterpret_cast<uintptr_t>(data) & 7); --size)
+      c = _mm_crc32_u8(c, *data++);
+#ifdef __x86_64__
+   uint64_t c64 = c;
+   for (; size >= 8; size -= 8, data += 8)
+      c64 = _mm_crc32_u64(c64, *reinterpret_cast<const uint64_t*>(data));
+   c = (uint32_t)c64;
+#endif
+   for (; size >= 4; size -= 4, data += 4)
+      c = _mm_crc32_u32(c, *reinterpret_cast<const uint32_t*>(data));
+   for (; size; --size)
+      c = _mm_crc32_u8(c, *data++);
+   return ~c;
+}
+#endif
+
+static Crc32c selectCrc32c()
+{
+#ifdef CRC32C_SSE42
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse4.2"))
+      return crc32cSse42;
+#endif
+   initTable();
+   return crc32cTable;
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t size)
+{
+   static const Crc32c impl = selectCrc32c();
+   return impl(crc, data, size);
+}
+
+ChecksumWriter::ChecksumWriter(const std::string& path, const char *stage)
+: _file(fopen(path.c_str(), "w"))
+{
+   if (!_file)
+      throw std::runtime_error("Could not open checksum sidecar " + path);
+   fprintf(_file, "#stage: %s\n#frame, pts, crc32c of each plane\n", stage);
+}
+
+ChecksumWriter::~ChecksumWriter()
+{
+   fclose(_file);
+}
+
+void ChecksumWriter::add(int64_t pts, const uint8_t *const data[4], const int linesizes[4],
+                         enum AVPixelFormat pixFmt, int width, int height)
+{
+   int rowBytes[4];
+   if (av_image_fill_linesizes(rowBytes, pixFmt, width) < 0)
+      throw std::runtime_error("Could not compute image line sizes");
+   const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pixFmt);
+
+   _crcs.clear();
+   for (int plane(0); plane < 4 && rowBytes[plane] && data[plane]; ++plane) {
+      int shift = (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0;
+      int rows = -((-height) >> shift);
+      uint32_t crc(0);
+      for (int y(0); y < rows; ++y)
+         crc = crc32c(crc, data[plane] + y * linesizes[plane], rowBytes[plane]);
+      _crcs.push_back(crc);
+   }
+   write(pts);
+}
+
+void ChecksumWriter::repeat(int64_t pts)
+{
+   write(pts);
+}
+
+void ChecksumWriter::write(int64_t pts)
+{
+   fprintf(_file, "%lld, %lld", (long long)_frames, (long long)pts);
+   for (auto crc(_crcs.begin()); crc != _crcs.end(); ++crc)
+      fprintf(_file, ", 0x%08x", *crc);
+   fputc('\n', _file);
+   ++_frames;
+}
@@ -0,0 +1,45 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "libav.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// CRC32C (Castagnoli) of size bytes, continuing from crc (0 to start). The
+// SSE4.2 crc32 instruction when the CPU has it, 8 table lookups per 8 bytes
+// otherwise; both give the same value.
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t size);
+
+// Per-frame, per-plane checksum sidecar for bit-exact regression checks, in
+// the spirit of the framecrc muxer. One text line per frame:
+//
+//    frame, pts, 0xcrc plane 0, 0xcrc plane 1, ...
+//
+// A plane is checksummed row by row without its line padding, so the same
+// picture gives the same line whatever the allocator. Compare two sidecars
+// with crccompare.
+class ChecksumWriter
+{
+public:
+   ChecksumWriter(const std::string& path, const char *stage);
+   virtual ~ChecksumWriter();
+   void add(int64_t pts, const uint8_t *const data[4], const int linesizes[4],
+            enum AVPixelFormat pixFmt, int width, int height);
+   // a frame with the planes of the previous one
+   void repeat(int64_t pts);
+   int64_t frames() const { return _frames; }
+
+private:
+   ChecksumWriter(const ChecksumWriter&);
+   ChecksumWriter& operator=(const ChecksumWriter&);
+   void write(int64_t pts);
+
+   FILE *_file;
+   int64_t _frames = 0;
+   std::vector<uint32_t> _crcs;
+};
+
+#endif // CHECKSUM_H
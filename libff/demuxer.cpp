@@ -1,26 +1,31 @@
 #include "demuxer.h"
 
-Demuxer::Demuxer(const char *src)
+Demuxer::Demuxer(const char *src, const char *dst)
 : _src_filename(src)
-//, video_dst_filename(dst)
+, _video_dst_filename(dst)
 {
+   // keep stdout for the raw video when it is streamed there
+   if (_video_dst_filename && !strcmp(_video_dst_filename, "-"))
+      _info = stderr;
 }
 
 
 int Demuxer::decodePacket(int *got_frame, int cached)
 {
    int ret = 0;
+   // packets of other streams decode nothing
+   *got_frame = 0;
    
-   if (_pkt.stream_index == _video_stream_idx) {
+   if (_pkt->stream_index == _video_stream_idx) {
       // decode video frame 
-      ret = avcodec_decode_video2(_video_dec_ctx, _frame, got_frame, &_pkt);
+      ret = avcodec_decode_video2(_video_dec_ctx, _frame.get(), got_frame, _pkt.get());
       if (ret < 0) {
          fprintf(stderr, "Error decoding video frame\n");
          return ret;
       }
       
       if (*got_frame) {
-         printf("video_frame%s n:%d coded_n:%d pts:%s\n",
+         fprintf(_info, "video_frame%s n:%d coded_n:%d pts:%s\n",
                 cached ? "(cached)" : "",
                 _video_frame_count++, _frame->coded_picture_number, 0);
 //                av_ts2timestr(frame->pts, &video_dec_ctx->time_base);
@@ -31,8 +36,23 @@ int Demuxer::decodePacket(int *got_frame, int cached)
                        (const uint8_t **)(_frame->data), _frame->linesize,
                        _video_dec_ctx->pix_fmt, _video_dec_ctx->width, _video_dec_ctx->height);
          
+         if (_checksums)
+            _checksums->add(_frame->pkt_pts, _video_dst_data, _video_dst_linesize,
+                            _video_dec_ctx->pix_fmt, _video_dec_ctx->width, _video_dec_ctx->height);
+
          // write to rawvideo file 
-         fwrite(_video_dst_data[0], 1, _video_dst_bufsize, _video_dst_file);
+         if (_video_dst_file)
+            fwrite(_video_dst_data[0], 1, _video_dst_bufsize, _video_dst_file);
+
+         // the destination buffer is already packed, publish it as is
+         if (_ring) {
+            uint8_t *slot = _ring->acquire();
+            memcpy(slot, _video_dst_data[0], _video_dst_bufsize);
+            int offsets[4];
+            for (int i(0); i < 4; ++i)
+               offsets[i] = _video_dst_data[i] ? _video_dst_data[i] - _video_dst_data[0] : 0;
+            _ring->commit(_frame->pkt_pts, _video_dst_bufsize, offsets, _video_dst_linesize);
+         }
       }
    } 
    
@@ -69,6 +89,7 @@ int Demuxer::openCodecContext(int *stream_idx, AVFormatContext *fmt_ctx, enum AV
                  av_get_media_type_string(type));
          return ret;
       }
+      _video_decoder.reset(dec_ctx);
    }
    
    return 0;
@@ -105,22 +126,36 @@ void Demuxer::demux()
    int ret = 0, got_frame;
    
    // register all formats and codecs 
-   av_register_all();
-   
-   // open input file, and allocate format context 
-   if (avformat_open_input(&_fmt_ctx, _src_filename, NULL, NULL) < 0)
+   initLibav();
+   
+   // stdin, pipes and sockets go through a custom, non seekable AVIO
+   if (StreamIO::isStream(_src_filename)) {
+      _input.reset(new StreamIO(_src_filename, false));
+      _fmt_ctx.reset(avformat_alloc_context());
+      _fmt_ctx->pb = _input->context();
+      _fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+   }
+
+   // open input file, and allocate format context; a failed open frees it
+   AVFormatContext *fmt_ctx = _fmt_ctx.release();
+   if (avformat_open_input(&fmt_ctx, _src_filename, NULL, NULL) < 0) {
       fprintf(stderr, "Could not open source file %s\n", _src_filename);
+      ret = 1;
+      goto end;
+   }
+   _fmt_ctx.reset(fmt_ctx);
    
    // retrieve stream information 
-   if (avformat_find_stream_info(_fmt_ctx, NULL) < 0)
+   if (avformat_find_stream_info(_fmt_ctx.get(), NULL) < 0)
       fprintf(stderr, "Could not find stream information\n");
    
-   if (openCodecContext(&_video_stream_idx, _fmt_ctx, AVMEDIA_TYPE_VIDEO) >= 0) {
+   if (openCodecContext(&_video_stream_idx, _fmt_ctx.get(), AVMEDIA_TYPE_VIDEO) >= 0) {
       _video_stream = _fmt_ctx->streams[_video_stream_idx];
       _video_dec_ctx = _video_stream->codec;
       
-      _video_dst_file = fopen(_video_dst_filename, "wb");
-      if (!_video_dst_file) {
+      if (_video_dst_filename)
+         _video_dst_file = strcmp(_video_dst_filename, "-") ? fopen(_video_dst_filename, "wb") : stdout;
+      if (_video_dst_filename && !_video_dst_file) {
          fprintf(stderr, "Could not open destination file %s\n", _video_dst_filename);
          ret = 1;
          goto end;
@@ -134,11 +169,19 @@ void Demuxer::demux()
          fprintf(stderr, "Could not allocate raw video buffer\n");
          goto end;
       }
+      _video_dst_buffer.reset(_video_dst_data[0]);
       _video_dst_bufsize = ret;
+
+      if (_ringName)
+         _ring.reset(new ShmRingWriter(_ringName, _ringSlots, _video_dst_bufsize,
+                                       _video_dec_ctx->width, _video_dec_ctx->height,
+                                       _video_dec_ctx->pix_fmt));
+      if (_checksumsPath)
+         _checksums.reset(new ChecksumWriter(_checksumsPath, "decoder"));
    }
    
    // dump input information to stderr 
-   av_dump_format(_fmt_ctx, 0, _src_filename, 0);
+   av_dump_format(_fmt_ctx.get(), 0, _src_filename, 0);
    
    if (!_video_stream) {
       fprintf(stderr, "Could not find video stream in the input, aborting\n");
@@ -146,51 +189,50 @@ void Demuxer::demux()
       goto end;
    }
    
-   _frame = avcodec_alloc_frame();
+   _frame.reset(avcodec_alloc_frame());
    if (!_frame) {
       fprintf(stderr, "Could not allocate frame\n");
       ret = AVERROR(ENOMEM);
       goto end;
    }
    
-   // initialize packet, set data to NULL, let the demuxer fill it 
-   av_init_packet(&_pkt);
-   _pkt.data = NULL;
-   _pkt.size = 0;
-   
    if (_video_stream)
-      printf("Demuxing video from file '%s' into '%s'\n", _src_filename, _video_dst_filename);
+      fprintf(_info, "Demuxing video from file '%s' into '%s'\n", _src_filename, _video_dst_filename);
    
    // read frames from the file 
-   while (av_read_frame(_fmt_ctx, &_pkt) >= 0) {
+   while (av_read_frame(_fmt_ctx.get(), _pkt.get()) >= 0) {
       decodePacket(&got_frame, 0);
-      av_free_packet(&_pkt);
+      _pkt.reset();
    }
    
-   // flush cached frames 
-   _pkt.data = NULL;
-   _pkt.size = 0;
-   do {
-      decodePacket(&got_frame, 1);
-   } while (got_frame);
+   // flush cached frames, the empty packet drains the decoder. reset() left
+   // it on stream 0, which need not be the video.
+   if (_video_stream) {
+      _pkt->stream_index = _video_stream_idx;
+      do {
+         decodePacket(&got_frame, 1);
+      } while (got_frame);
+   }
    
-   printf("Demuxing succeeded.\n");
+   fprintf(_info, "Demuxing succeeded.\n");
    
-   if (_video_stream) {
-      printf("Play the output video file with the command:\n"
+   if (_video_stream && _video_dst_filename) {
+      fprintf(_info, "Play the output video file with the command:\n"
              "ffplay -f rawvideo -pix_fmt %s -video_size %dx%d %s\n",
              av_get_pix_fmt_name(_video_dec_ctx->pix_fmt), _video_dec_ctx->width, _video_dec_ctx->height,
              _video_dst_filename);
    }
       
 end:
-   if (_video_dec_ctx)
-      avcodec_close(_video_dec_ctx);
-   avformat_close_input(&_fmt_ctx);
-   if (_video_dst_file)
+   if (_video_dst_file && _video_dst_file != stdout)
       fclose(_video_dst_file);
-   av_free(_frame);
-   av_free(_video_dst_data[0]);
+   // the decoder before the context that owns it, the context before its input
+   _ring.reset();
+   _frame.reset();
+   _video_dst_buffer.reset();
+   _video_decoder.reset();
+   _fmt_ctx.reset();
+   _input.reset();
    
 //   return ret < 0;
 }
@@ -19,6 +19,11 @@
 #include <exception>
 #include <stdexcept>
 
+#include "avptr.h"
+#include "checksum.h"
+#include "shmring.h"
+#include "streamio.h"
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
@@ -38,7 +43,12 @@ extern "C" {
 class Demuxer
 {
 public:
-   Demuxer(const char *src);
+   Demuxer(const char *src, const char *dst = NULL);
+   // Publish decoded frames to a shared memory ring of the given name,
+   // alone or next to the raw destination file.
+   void setFrameRing(const char *name, int slots = 8) { _ringName = name; _ringSlots = slots; }
+   // Per-frame checksums of the decoded frames to a sidecar, see ChecksumWriter.
+   void setChecksums(const char *path) { _checksumsPath = path; }
    void demux();
    
 private: 
@@ -46,21 +56,32 @@ private:
    int openCodecContext(int *stream_idx, AVFormatContext *_fmt_ctx, enum AVMediaType type);
    int getFormatFromSampleFmt(const char **fmt, enum AVSampleFormat sample_fmt);
 
-   AVFormatContext *_fmt_ctx = NULL;
+   // before the format context that reads from it
+   std::unique_ptr<StreamIO> _input;
+   InputFormatPtr _fmt_ctx;
    AVCodecContext *_video_dec_ctx = NULL;
+   OpenCodecPtr _video_decoder;
    AVStream *_video_stream = NULL;
    const char *_src_filename = NULL;
    const char *_video_dst_filename = NULL;
    FILE *_video_dst_file = NULL;
+   FILE *_info = stdout;
    
    uint8_t *_video_dst_data[4] = {NULL};
+   AvMallocPtr<uint8_t> _video_dst_buffer;
    int      _video_dst_linesize[4];
    int _video_dst_bufsize;
    
    int _video_stream_idx = -1;
-   AVFrame *_frame = NULL;
-   AVPacket _pkt;
+   FramePtr _frame;
+   Packet _pkt;
    int _video_frame_count = 0;
+
+   const char *_ringName = NULL;
+   int _ringSlots = 0;
+   std::unique_ptr<ShmRingWriter> _ring;
+   const char *_checksumsPath = NULL;
+   std::unique_ptr<ChecksumWriter> _checksums;
 };
 
 #endif // DEMUXER_HPP
@@ -0,0 +1,78 @@
+#include "duplicates.h"
+
+#include <cstdlib>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static uint64_t rowSad(const uint8_t *a, const uint8_t *b, int bytes)
+{
+   uint64_t sad(0);
+   int x(0);
+#ifdef __SSE2__
+   // psadbw: 16 absolute differences summed into two 64 bit lanes per instruction
+   __m128i sum = _mm_setzero_si128();
+   for (; x + 16 <= bytes; x += 16)
+      sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x)),
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x))));
+   uint64_t lanes[2];
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+   sad = lanes[0] + lanes[1];
+#endif
+   for (; x < bytes; ++x)
+      sad += abs(a[x] - b[x]);
+   return sad;
+}
+
+DuplicateDetector::DuplicateDetector(enum AVPixelFormat pixFmt, double threshold)
+: _pixFmt(pixFmt)
+, _threshold(threshold)
+{
+}
+
+bool DuplicateDetector::check(const Image& image)
+{
+   ++_frames;
+   image->duplicate = _reference && matches(image);
+   if (image->duplicate)
+      ++_duplicates;
+   else
+      _reference = image;
+   return image->duplicate;
+}
+
+bool DuplicateDetector::matches(const Image& image) const
+{
+   if (image->width != _reference->width || image->height != _reference->height)
+      return false;
+   int rowBytes[4];
+   if (av_image_fill_linesizes(rowBytes, _pixFmt, image->width) < 0)
+      return false;
+   const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(_pixFmt);
+
+   int64_t bytes(0);
+   for (int plane(0); plane < 4 && rowBytes[plane]; ++plane) {
+      int shift = (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0;
+      bytes += (int64_t)rowBytes[plane] * (-((-image->height) >> shift));
+   }
+   uint64_t limit = (uint64_t)(_threshold * bytes);
+
+   uint64_t sad(0);
+   for (int plane(0); plane < 4 && rowBytes[plane]; ++plane) {
+      int shift = (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0;
+      int height = -((-image->height) >> shift);
+      for (int y(0); y < height; ++y) {
+         sad += rowSad(image->data[plane] + y * image->linesizes[plane],
+                       _reference->data[plane] + y * _reference->linesizes[plane], rowBytes[plane]);
+         // most distinct frames are rejected within a few rows
+         if (sad > limit)
+            return false;
+      }
+   }
+   return true;
+}
@@ -0,0 +1,34 @@
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+#include "image.h"
+#include "libav.h"
+
+// Flags frames that repeat the previous distinct frame (freeze frames,
+// slates) so muxers can repeat its packet instead of encoding them again.
+// Frames are compared with a vectorized sum of absolute differences that
+// stops as soon as the threshold is exceeded.
+class DuplicateDetector
+{
+public:
+   // threshold is the mean absolute difference per byte under which a frame
+   // is a duplicate, 0 only accepts identical frames
+   DuplicateDetector(enum AVPixelFormat pixFmt, double threshold = 0.);
+   // Sets image->duplicate and returns it.
+   bool check(const Image& image);
+   int64_t frames() const { return _frames; }
+   int64_t duplicates() const { return _duplicates; }
+
+private:
+   bool matches(const Image& image) const;
+
+   enum AVPixelFormat _pixFmt;
+   double _threshold;
+   // the last frame that was not a duplicate, duplicates are compared with
+   // it so that slow fades never pass as a run of near duplicates
+   Image _reference;
+   int64_t _frames = 0;
+   int64_t _duplicates = 0;
+};
+
+#endif // DUPLICATES_H
@@ -0,0 +1,80 @@
+#include "encoderpool.h"
+
+#include <stdexcept>
+#include <tuple>
+
+EncoderKey EncoderKey::of(const AVCodecContext *ctx)
+{
+   EncoderKey key;
+   key.codec = ctx->codec_id;
+   key.pixFmt = ctx->pix_fmt;
+   key.width = ctx->width;
+   key.height = ctx->height;
+   key.bitRate = ctx->bit_rate;
+   key.timeBase = ctx->time_base;
+   key.gopSize = ctx->gop_size;
+   key.maxBFrames = ctx->max_b_frames;
+   key.flags = ctx->flags;
+   key.threadType = ctx->thread_type;
+   return key;
+}
+
+bool EncoderKey::operator<(const EncoderKey& other) const
+{
+   return std::tie(codec, pixFmt, width, height, bitRate, timeBase.num, timeBase.den,
+                   gopSize, maxBFrames, flags, threadType)
+        < std::tie(other.codec, other.pixFmt, other.width, other.height, other.bitRate,
+                   other.timeBase.num, other.timeBase.den,
+                   other.gopSize, other.maxBFrames, other.flags, other.threadType);
+}
+
+EncoderPool::EncoderPool(int idle)
+: _idle(idle)
+{
+}
+
+CodecContextPtr EncoderPool::acquire(const EncoderKey& key, const AVCodecContext *params, AVCodec *codec,
+                                     AVDictionary **options)
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::vector<CodecContextPtr>& idle = _encoders[key];
+      if (!idle.empty()) {
+         CodecContextPtr encoder(std::move(idle.back()));
+         idle.pop_back();
+         ++_hits;
+         return encoder;
+      }
+      ++_misses;
+   }
+   // opened outside the lock, the lock manager serializes avcodec_open2
+   CodecContextPtr encoder(avcodec_alloc_context3(codec));
+   if (!encoder)
+      throw std::runtime_error("Could not allocate encoder context");
+   if (avcodec_copy_context(encoder.get(), params) < 0)
+      throw std::runtime_error("Could not copy encoder parameters");
+   if (avcodec_open2(encoder.get(), codec, options) < 0)
+      throw std::runtime_error("Could not open video codec");
+   return encoder;
+}
+
+void EncoderPool::release(const EncoderKey& key, CodecContextPtr encoder)
+{
+   avcodec_flush_buffers(encoder.get());
+   std::lock_guard<std::mutex> lock(_mutex);
+   std::vector<CodecContextPtr>& idle = _encoders[key];
+   if ((int)idle.size() < _idle)
+      idle.push_back(std::move(encoder));
+}
+
+int EncoderPool::hits() const
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   return _hits;
+}
+
+int EncoderPool::misses() const
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   return _misses;
+}
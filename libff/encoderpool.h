@@ -0,0 +1,57 @@
+#ifndef ENCODERPOOL_H
+#define ENCODERPOOL_H
+
+#include "avptr.h"
+#include "libav.h"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+// The encoder parameters an opened codec context is bound to.
+struct EncoderKey
+{
+   enum AVCodecID codec = AV_CODEC_ID_NONE;
+   enum AVPixelFormat pixFmt = AV_PIX_FMT_NONE;
+   int width = 0;
+   int height = 0;
+   int bitRate = 0;
+   AVRational timeBase = {0, 1};
+   int gopSize = 0;
+   int maxBFrames = 0;
+   int flags = 0;
+   int threadType = 0;
+
+   static EncoderKey of(const AVCodecContext *ctx);
+   bool operator<(const EncoderKey& other) const;
+};
+
+// Opened encoders kept between jobs. avcodec_open2 builds sizeable tables
+// for some codecs (DNxHD, the mpeg family), a process running job after
+// job with the same rendition settings opens each encoder once.
+class EncoderPool
+{
+public:
+   // Keeps at most idle encoders of each key.
+   EncoderPool(int idle = 4);
+   // An idle encoder for key, else one opened now from the parameters of
+   // params, which stays unopened.
+   CodecContextPtr acquire(const EncoderKey& key, const AVCodecContext *params, AVCodec *codec,
+                           AVDictionary **options);
+   // Takes back an encoder without pending frames, flushed for the next job.
+   void release(const EncoderKey& key, CodecContextPtr encoder);
+   int hits() const;
+   int misses() const;
+
+private:
+   EncoderPool(const EncoderPool&);
+   EncoderPool& operator=(const EncoderPool&);
+
+   const int _idle;
+   std::map<EncoderKey, std::vector<CodecContextPtr>> _encoders;
+   int _hits = 0;
+   int _misses = 0;
+   mutable std::mutex _mutex;
+};
+
+#endif // ENCODERPOOL_H
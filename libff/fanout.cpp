@@ -0,0 +1,121 @@
+#include "fanout.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+FanOut::FanOut(int queueDepth)
+: _queueDepth(std::max(1, queueDepth))
+{
+}
+
+FanOut::~FanOut()
+{
+   stop();
+}
+
+void FanOut::addMuxer(std::unique_ptr<Muxer> muxer)
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   if (_first || !_batches.empty())
+      throw std::runtime_error("Renditions must be added before the first frame");
+   _outputs.push_back(std::unique_ptr<Output>(new Output));
+   Output& output = *_outputs.back();
+   output.muxer = std::move(muxer);
+   output.thread = std::thread(&FanOut::run, this, std::ref(output));
+}
+
+void FanOut::run(Output& output)
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   for (size_t index(0); index < _outputs.size(); ++index)
+      if (_outputs[index].get() == &output)
+         Trace::setThreadName("rendition " + std::to_string(index));
+   for (;;) {
+      _cond.wait(lock, [&] { return output.written < _first + (int64_t)_batches.size() || _closing; });
+      if (output.written == _first + (int64_t)_batches.size()) {
+         if (_finishing && !output.error) {
+            lock.unlock();
+            try {
+               output.muxer->close();
+            }
+            catch (...) {
+               output.error = std::current_exception();
+            }
+         }
+         return;
+      }
+
+      // deque elements stay put while other batches are pushed or released
+      const Batch& batch = _batches[output.written - _first];
+      lock.unlock();
+      if (!output.error) {
+         try {
+            output.muxer->writeAudioPackets(batch.audio);
+            output.muxer->writeVideoFrames(batch.images);
+         }
+         catch (...) {
+            // keep consuming so the producer never waits on a failed rendition
+            output.error = std::current_exception();
+         }
+      }
+      lock.lock();
+      ++output.written;
+      _cond.notify_all();
+   }
+}
+
+void FanOut::releaseWritten()
+{
+   // Batches are dropped on the producer thread: borrowed frames go back to
+   // the filter graph buffer pool, which is not thread safe.
+   while (!_batches.empty()) {
+      for (auto output(_outputs.begin()); output != _outputs.end(); ++output)
+         if ((*output)->written == _first)
+            return;
+      _batches.pop_front();
+      ++_first;
+   }
+}
+
+void FanOut::writeVideoFrames(const Images& images)
+{
+   write(images, PacketRefs());
+}
+
+void FanOut::write(const Images& images, const PacketRefs& audio)
+{
+   if (images.empty() && audio.empty())
+      return;
+   std::unique_lock<std::mutex> lock(_mutex);
+   _cond.wait(lock, [&] { releaseWritten(); return (int)_batches.size() < _queueDepth; });
+   _batches.push_back(Batch{images, audio});
+   _cond.notify_all();
+}
+
+void FanOut::stop()
+{
+   {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _closing = true;
+      _cond.notify_all();
+   }
+   for (auto output(_outputs.begin()); output != _outputs.end(); ++output)
+      if ((*output)->thread.joinable())
+         (*output)->thread.join();
+   std::unique_lock<std::mutex> lock(_mutex);
+   releaseWritten();
+}
+
+void FanOut::finish()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _finishing = true;
+   }
+   stop();
+   for (auto output(_outputs.begin()); output != _outputs.end(); ++output)
+      if ((*output)->error)
+         std::rethrow_exception((*output)->error);
+}
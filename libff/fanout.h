@@ -0,0 +1,69 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "image.h"
+#include "muxer.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Feeds the frames of one Filter to several Muxer renditions. Frames are
+// shared by reference and every rendition scales and encodes on its own
+// thread, so decoding and filtering are paid once for all outputs. Audio
+// packets travel with the frames they were read with.
+class FanOut
+{
+public:
+   FanOut(int queueDepth = 2);
+   virtual ~FanOut();
+   void addMuxer(std::unique_ptr<Muxer> muxer);
+   Muxer& muxer(int index) { return *_outputs[index]->muxer; }
+   int size() const { return _outputs.size(); }
+   void writeVideoFrames(const Images& images);
+   // Frames and the audio packets read along with them; every rendition
+   // writes the packets of the audio streams it carries.
+   void write(const Images& images, const PacketRefs& audio);
+   // Waits for every rendition to write the queued frames and close its
+   // output, on its own thread: the frames the encoder still holds, the
+   // trailer and the last fragment. Rethrows the first rendition error.
+   void finish();
+
+private:
+   struct Output
+   {
+      std::unique_ptr<Muxer> muxer;
+      std::thread thread;
+      int64_t written = 0;
+      std::exception_ptr error;
+   };
+
+   struct Batch
+   {
+      Images images;
+      PacketRefs audio;
+   };
+
+   FanOut(const FanOut&);
+   FanOut& operator=(const FanOut&);
+   void run(Output& output);
+   void releaseWritten();
+   void stop();
+
+   const int _queueDepth;
+   std::vector<std::unique_ptr<Output>> _outputs;
+   // batches not yet written by every rendition, _first numbers the front one
+   std::deque<Batch> _batches;
+   int64_t _first = 0;
+   bool _closing = false;
+   // closing after the last frame rather than on an error
+   bool _finishing = false;
+   std::mutex _mutex;
+   std::condition_variable _cond;
+};
+
+#endif // FANOUT_H
@@ -0,0 +1,407 @@
+#include "filter.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <exception>
+#include <stdexcept>
+
+Filter::Filter(const char *src, const FilterConfig& config)
+: _filename(src)
+, _config(config)
+, _interrupt(config.cancel, config.ioTimeout)
+{
+   init();
+}
+
+Filter::~Filter()
+{
+}
+
+void Filter::init()
+{
+   initLibav();
+   _frame = allocFrame();
+
+   if (!_config.filters.empty())
+      _filterDescr = _config.filters;
+   else if (_config.lowDelay)
+      _filterDescr = "yadif";
+   if (_config.rebuildFrames > 0)
+      _rebuildFrames = _config.rebuildFrames;
+   else if (_filterDescr == "yadif,decimate" || _filterDescr == "yadif")
+      _rebuildFrames = DEFAULT_REBUILD_FRAMES;
+
+   openInputFile();
+   initFilters();
+   if (!_config.checksums.empty())
+      _checksums.reset(new ChecksumWriter(_config.checksums, "filter"));
+}
+
+void Filter::openInputFile()
+{
+   AVCodec *dec;
+   _fmtCtx.reset(avformat_alloc_context());
+   if (!_fmtCtx)
+      throw std::runtime_error("Could not allocate input context");
+   // opening, probing and every read give up on cancel or timeout
+   _fmtCtx->interrupt_callback = _interrupt.callback();
+   if (_config.lowDelay) {
+      _fmtCtx->flags |= AVFMT_FLAG_NOBUFFER;
+      // don't sit on seconds of input to guess stream parameters
+      _fmtCtx->probesize = 32 * 1024;
+      _fmtCtx->max_analyze_duration = AV_TIME_BASE / 10;
+   }
+   if (StreamIO::isStream(_filename)) {
+      // stdin, pipe or socket: the input can't be seeked, so a mov needs its moov up front
+      _input.reset(new StreamIO(_filename, false));
+      _input->setInterruptCallback(_interrupt.callback());
+      _fmtCtx->pb = _input->context();
+      _fmtCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+   }
+   // avformat_open_input frees the context when it fails
+   AVFormatContext *fmtCtx = _fmtCtx.release();
+   int ret;
+   {
+      IoInterrupt::Operation operation(_interrupt);
+      ret = avformat_open_input(&fmtCtx, _filename, NULL, NULL);
+   }
+   if (ret < 0) {
+      _interrupt.check("opening the input");
+      throw std::runtime_error("Cannot open input file\n");
+   }
+   _fmtCtx.reset(fmtCtx);
+
+   {
+      IoInterrupt::Operation operation(_interrupt);
+      ret = avformat_find_stream_info(_fmtCtx.get(), NULL);
+   }
+   if (ret < 0) {
+      _interrupt.check("probing the input");
+      throw std::runtime_error("Cannot find stream information\n");
+   }
+
+   // select the video stream
+   if ((_videoStreamIndex = av_find_best_stream(_fmtCtx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, &dec, 0)) < 0)
+      throw std::runtime_error("Cannot find a video stream in the input file");
+   _decCtx = _fmtCtx->streams[_videoStreamIndex]->codec;
+   if (_config.audio)
+      for (unsigned i(0); i < _fmtCtx->nb_streams; ++i)
+         if (_fmtCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+            _audioStreams.push_back(_fmtCtx->streams[i]);
+
+   if (_config.lowDelay) {
+      // frame threads add a frame of delay per thread
+      _decCtx->flags |= CODEC_FLAG_LOW_DELAY;
+      _decCtx->thread_type = FF_THREAD_SLICE;
+   }
+
+   // init the video decoder
+   if (avcodec_open2(_decCtx, dec, NULL) < 0)
+      throw std::runtime_error("Cannot open video decoder\n");
+   _decoder.reset(_decCtx);
+}
+
+void Filter::initFilters()
+{
+   GraphKey key;
+   key.description = _filterDescr;
+   key.width = _decCtx->width;
+   key.height = _decCtx->height;
+   key.pixFmt = _decCtx->pix_fmt;
+   key.timeBase = _fmtCtx->streams[_videoStreamIndex]->time_base;
+   key.sampleAspect = _decCtx->sample_aspect_ratio;
+   key.sinkFmt = STREAM_PIX_FMT;
+   _graph = _config.graphs ? _config.graphs->acquire(key) : GraphPool::build(key);
+   _buffersrcCtx = _graph->source;
+   _buffersinkCtx = _graph->sink;
+}
+
+int64_t Filter::bytesRead() const
+{
+   if (_input)
+      return _input->bytes();
+   return _fmtCtx && _fmtCtx->pb ? avio_tell(_fmtCtx->pb) : 0;
+}
+
+Images& Filter::readVideoFrames(int frameWindow)
+{
+   _images.erase(_images.begin(), _images.end());
+   for(int frame(0); frame < frameWindow; ++frame)
+   {
+      Image image = readVideoFrame();
+      if(image == nullptr)
+         break;
+      _images.push_back(image);
+   }
+   return _images;
+}
+
+Image Filter::readVideoFrame()
+{
+   _interrupt.checkToken("filtering");
+   // one packet can release several frames, hand out what the sink holds first
+   Image image = pullFrame();
+   if (image)
+      return image;
+
+   while (_state == READING) {
+      if (readPacket() < 0) {
+         _state = FLUSHING_DECODER;
+         break;
+      }
+      bool pushed(false);
+      if (_packet->stream_index == _videoStreamIndex)
+         pushed = decodePacket();
+      else
+         keepAudioPacket();
+      _packet.reset();
+      if (pushed && (image = pullFrame()))
+         return image;
+   }
+   // At the end of the input the decoder still holds the frames of its
+   // delay: an empty packet returns them one at a time.
+   while (_state == FLUSHING_DECODER) {
+      if (!decodePacket()) {
+         // then the graph gives up what yadif and decimate held back
+         if (av_buffersrc_add_frame(_buffersrcCtx, NULL, 0) < 0)
+            throw std::runtime_error("Error while closing the filtergraph input");
+         _state = FLUSHING_GRAPH;
+         break;
+      }
+      if ((image = pullFrame()))
+         return image;
+   }
+   if (_state == FLUSHING_GRAPH) {
+      if ((image = pullFrame()))
+         return image;
+      _state = FINISHED;
+   }
+   return nullptr;
+}
+
+bool Filter::decodePacket()
+{
+   Clock::time_point readTime = Clock::now();
+   avcodec_get_frame_defaults(_frame.get());
+   int gotFrame(0);
+   int len(0);
+   {
+      PerfStats::Scope scope(_perf.get(), PERF_DECODE);
+      TraceSpan span("decode", _packet->pts);
+      len = avcodec_decode_video2(_decCtx, _frame.get(), &gotFrame, _packet.get());
+   }
+   if (len < 0) {
+      if (_state != READING)
+         // a decoder that fails to flush has nothing more to give
+         return false;
+      throw std::runtime_error("Error decoding video");
+   }
+   if (!gotFrame)
+      return false;
+
+   _frame->pts = av_frame_get_best_effort_timestamp(_frame.get());
+   if (_resumePts != AV_NOPTS_VALUE) {
+      // decoded from the key frame before the resume point
+      if (_frame->pts < _resumePts)
+         return true;
+      _resumePts = AV_NOPTS_VALUE;
+   }
+   if (_rebuildFrames && _inputFrames % _rebuildFrames == 0) {
+      _resumePoints.push_back(std::make_pair(_inputFrames, _frame->pts));
+      if (_resumePoints.size() > RESUME_POINTS)
+         _resumePoints.pop_front();
+   }
+   _inputFrames++;
+   _inputTimes[_frame->pts] = readTime;
+   // push the decoded frame into the filtergraph
+   int ret;
+   {
+      PerfStats::Scope scope(_perf.get(), PERF_FILTER);
+      TraceSpan span("filter", _frame->pts);
+      ret = av_buffersrc_add_frame(_buffersrcCtx, _frame.get(), 0);
+   }
+   if (ret < 0)
+      throw std::runtime_error("Error while feeding the filtergraph");
+   return true;
+}
+
+void Filter::keepAudioPacket()
+{
+   auto audio = std::find_if(_audioStreams.begin(), _audioStreams.end(),
+                             [&](AVStream *stream) { return stream->index == _packet->stream_index; });
+   if (audio == _audioStreams.end())
+      return;
+   // the frames are timed from the first video timestamp, see pullFrame
+   AVStream *video = _fmtCtx->streams[_videoStreamIndex];
+   if (video->start_time != AV_NOPTS_VALUE) {
+      int64_t start = av_rescale_q(video->start_time, video->time_base, (*audio)->time_base);
+      if (_packet->pts != AV_NOPTS_VALUE)
+         _packet->pts -= start;
+      if (_packet->dts != AV_NOPTS_VALUE)
+         _packet->dts -= start;
+   }
+   // nothing to play against before the first picture
+   if (_packet->pts != AV_NOPTS_VALUE && _packet->pts < 0)
+      return;
+   _audioPackets.push_back(sharePacket(_packet));
+}
+
+PacketRefs Filter::takeAudioPackets()
+{
+   PacketRefs packets;
+   packets.swap(_audioPackets);
+   return packets;
+}
+
+void Filter::resumeFrom(int64_t frame, int64_t pts)
+{
+   // from the start: nothing to rebuild
+   if (frame <= 0)
+      return;
+   if (_input)
+      throw std::runtime_error("Can't resume from a stream input");
+   if (!_rebuildFrames)
+      throw std::runtime_error("Can't resume filter graph \"" + _filterDescr + "\" from input frame "
+                               + std::to_string(frame) + ", it has no known rebuild window");
+   if (frame % _rebuildFrames)
+      throw std::runtime_error("Resume point " + std::to_string(frame) + " is not a multiple of "
+                               + std::to_string(_rebuildFrames) + " input frames");
+   if (av_seek_frame(_fmtCtx.get(), _videoStreamIndex, pts, AVSEEK_FLAG_BACKWARD) < 0)
+      throw std::runtime_error("Could not seek the input to resume");
+   avcodec_flush_buffers(_decCtx);
+   _inputFrames = frame;
+   _resumePoints.clear();
+   _resumePts = pts;
+   _inputTimes.clear();
+   _audioPackets.clear();
+}
+
+AVRational Filter::frameRate() const
+{
+   AVRational rate = _buffersinkCtx->inputs[0]->frame_rate;
+   if (rate.num <= 0 || rate.den <= 0)
+      rate = _fmtCtx->streams[_videoStreamIndex]->r_frame_rate;
+   return rate;
+}
+
+int Filter::readPacket()
+{
+   PerfStats::Scope scope(_perf.get(), PERF_DEMUX);
+   TraceSpan span("read");
+   int ret;
+   {
+      IoInterrupt::Operation operation(_interrupt);
+      ret = av_read_frame(_fmtCtx.get(), _packet.get());
+   }
+   if (ret >= 0)
+      span.setPts(_packet->pts);
+   else
+      // not the end of the input when we cut the read short
+      _interrupt.check("reading the input");
+   return ret;
+}
+
+void Filter::enablePerfCounters()
+{
+   _perf.reset(new PerfStats({"demux", "decode", "filter"}));
+   _perf->open();
+}
+
+Image Filter::pullFrame()
+{
+   AVFilterBufferRef *picref;
+   int ret;
+   {
+      // the graph runs its filters when the sink is pulled
+      PerfStats::Scope scope(_perf.get(), PERF_FILTER);
+      TraceSpan span("filter");
+      // pull a filtered picture from the filtergraph
+      ret = av_buffersink_get_buffer_ref(_buffersinkCtx, &picref, 0);
+      if (ret >= 0 && picref)
+         span.setPts(picref->pts);
+   }
+   if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF || (ret >= 0 && !picref))
+      return nullptr;
+   if (ret < 0)
+      throw std::runtime_error("Could not pull filtered pictures from the filtergraph");
+   BufferRefPtr ref(picref);
+
+   Image image(new ImageImpl);
+   image->width = picref->video->w;
+   image->height = picref->video->h;
+   image->pts = picref->pts;
+   if (!_resumePoints.empty()) {
+      image->resumeFrame = _resumePoints.front().first;
+      image->resumePts = _resumePoints.front().second;
+   }
+   if (picref->pts != AV_NOPTS_VALUE) {
+      AVStream *stream = _fmtCtx->streams[_videoStreamIndex];
+      AVRational timeBase = _buffersinkCtx->inputs[0]->time_base;
+      int64_t start = stream->start_time != AV_NOPTS_VALUE
+            ? av_rescale_q(stream->start_time, stream->time_base, timeBase) : 0;
+      image->time = (picref->pts - start) * av_q2d(timeBase);
+   }
+
+   if (_checksums) {
+      TraceSpan span("checksum", picref->pts);
+      _checksums->add(picref->pts, picref->data, picref->linesize, STREAM_PIX_FMT,
+                      image->width, image->height);
+   }
+
+   // the graph keeps input timestamps, frames it dropped leave older entries behind
+   auto input = _inputTimes.upper_bound(picref->pts);
+   if (input != _inputTimes.begin()) {
+      image->inputTime = (--input)->second;
+      _inputTimes.erase(_inputTimes.begin(), ++input);
+   }
+
+   if (_borrowFrames) {
+      for (int i(0); i < 4; ++i) {
+         image->data[i] = picref->data[i];
+         image->linesizes[i] = picref->linesize[i];
+      }
+      image->ref = ref.release();
+      if (_frameRing)
+         publish(image, picref->pts);
+      return image;
+   }
+   TraceSpan span("copy", picref->pts);
+   int size;
+   if (_allocator) {
+      size = allocImage(image->data, image->linesizes, image->width, image->height,
+                        STREAM_PIX_FMT, *_allocator);
+      image->allocator = _allocator;
+      image->allocSize = size;
+   }
+   else
+      // the same line alignment as the allocator's buffers
+      size = av_image_alloc(image->data, image->linesizes, image->width, image->height,
+                            STREAM_PIX_FMT, FrameAllocator::ALIGNMENT);
+   av_image_copy(image->data, image->linesizes, (const uint8_t **)picref->data,
+                 (const int*)picref->linesize, STREAM_PIX_FMT, image->width, image->height);
+   _bytesCopied += 2 * (int64_t)size;
+   if (_frameRing)
+      publish(image, picref->pts);
+   return image;
+}
+
+void Filter::publish(const Image& image, int64_t pts)
+{
+   // the slot holds the frame without line padding
+   uint8_t *slot = _frameRing->acquire();
+   uint8_t *data[4];
+   int linesizes[4], offsets[4];
+   av_image_fill_linesizes(linesizes, STREAM_PIX_FMT, image->width);
+   int size = av_image_fill_pointers(data, STREAM_PIX_FMT, image->height, slot, linesizes);
+   if (size < 0 || size > _frameRing->slotSize())
+      throw std::runtime_error("Frame does not fit the shared memory ring");
+   av_image_copy(data, linesizes, (const uint8_t **)image->data, image->linesizes,
+                 STREAM_PIX_FMT, image->width, image->height);
+   for (int i(0); i < 4; ++i)
+      offsets[i] = data[i] ? data[i] - slot : 0;
+   _frameRing->commit(pts, size, offsets, linesizes);
+}
@@ -0,0 +1,158 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "avptr.h"
+#include "cancel.h"
+#include "checksum.h"
+#include "graphpool.h"
+#include "image.h"
+#include "perfcounters.h"
+#include "shmring.h"
+#include "streamio.h"
+#include "trace.h"
+
+#include "libav.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct FilterConfig
+{
+   // libavfilter graph description between the decoder and the sink, e.g.
+   // "yadif,decimate" or "showinfo,interlace,yadif,scale=78:24"; empty for
+   // the default, which drops decimate for low delay.
+   std::string filters;
+   // Live ingest: no demuxer or decoder frame buffering, slice instead of
+   // frame threads and no decimate (it holds back a whole cycle), so each
+   // input frame leaves the filter as soon as it is decoded.
+   bool lowDelay = false;
+   // Configured graphs come from this pool instead of being built on open.
+   std::shared_ptr<GraphPool> graphs;
+   // Also keep the compressed packets of every audio stream, for a Muxer to
+   // copy into its output; see takeAudioPackets.
+   bool audio = false;
+   // Per-frame checksums of the filtered frames to this sidecar, see
+   // ChecksumWriter.
+   std::string checksums;
+   // Cancels reading and filtering; readVideoFrame throws Cancelled.
+   std::shared_ptr<CancelToken> cancel;
+   // ms any one open, probe or packet read may block, 0 for no limit
+   int ioTimeout = 0;
+   // Input frames the graph needs to reach the state of a run from the start
+   // of the input, see Filter::resumeFrom. 0 takes it from the graph: known
+   // for the default ones, unknown for other filters, which then resume by
+   // running from the start of the input.
+   int rebuildFrames = 0;
+};
+
+class Filter
+{
+public:
+   Filter(const char* dst, const FilterConfig& config = FilterConfig());
+   virtual ~Filter();
+   Images& getImages() { return _images; }
+   Images& readVideoFrames(int frameWindow = 1000);
+   // The next filtered frame, nullptr once the input, the decoder and the
+   // graph are exhausted. See framesource.h for a pull API on top of it.
+   Image readVideoFrame();
+   // Borrowed frames reference the filter graph buffers instead of copying
+   // them; they must be treated as read-only.
+   void setBorrowFrames(bool borrow) { _borrowFrames = borrow; }
+   int64_t bytesCopied() const { return _bytesCopied; }
+   // Also publish every filtered frame to local consumers.
+   void setFrameRing(ShmRingWriter *ring) { _frameRing = ring; }
+   // Copied frames come from this allocator instead of av_malloc.
+   void setFrameAllocator(const std::shared_ptr<FrameAllocator>& allocator) { _allocator = allocator; }
+   int width() const { return _buffersinkCtx->inputs[0]->w; }
+   int height() const { return _buffersinkCtx->inputs[0]->h; }
+   enum AVPixelFormat pixelFormat() const { return STREAM_PIX_FMT; }
+   int64_t bytesRead() const;
+   // Hardware counters for the demux, decode and filter stages of the
+   // calling thread, which must be the one reading the frames.
+   void enablePerfCounters();
+   const PerfStats *perfStats() const { return _perf.get(); }
+   const std::string& filters() const { return _filterDescr; }
+   // parse and config time of the graph, paid now or ahead by a GraphPool
+   double graphSetupSeconds() const { return _graph->setupSeconds; }
+   bool graphPrebuilt() const { return _graph->prebuilt; }
+   // rate of the filtered frames, the input rate changed by decimate
+   AVRational frameRate() const;
+   // With FilterConfig::audio, the input audio streams and the packets read
+   // since the last call. The packet timestamps are moved to the timeline of
+   // the frames, which starts at the first video timestamp of the input;
+   // packets from before it are dropped.
+   const std::vector<AVStream*>& audioStreams() const { return _audioStreams; }
+   PacketRefs takeAudioPackets();
+   // Restarts at input frame number frame of pts pts, the resume point of a
+   // frame handed out by an earlier run over the same input; call it before
+   // the first frame is read. The graph is fed from that input frame on, so
+   // that frame and the ones after it come out as in the earlier run, the
+   // ones before it may not. Seekable inputs only.
+   void resumeFrom(int64_t frame, int64_t pts);
+
+private:
+   void init();
+   void initFilters();
+   void openInputFile();
+   void publish(const Image& image, int64_t pts);
+   Image pullFrame();
+   int readPacket();
+   bool decodePacket();
+   void keepAudioPacket();
+
+   const char *_filename;
+   FilterConfig _config;
+   std::string _filterDescr = "yadif,decimate";
+   const enum AVPixelFormat STREAM_PIX_FMT = AV_PIX_FMT_RGB444; // AV_PIX_FMT_GRAY8 AV_PIX_FMT_YUV422P AV_PIX_FMT_BGR32 AV_PIX_FMT_RGB444
+   const size_t RESUME_POINTS = 3;
+   // of the default graphs: a multiple of the decimate cycle, and more than
+   // yadif and decimate hold back
+   const int DEFAULT_REBUILD_FRAMES = 10;
+
+   // declared in the order they are acquired: each is released before the
+   // ones it depends on
+   IoInterrupt _interrupt;
+   std::unique_ptr<StreamIO> _input;
+   InputFormatPtr _fmtCtx;
+   AVCodecContext *_decCtx = nullptr;
+   OpenCodecPtr _decoder;
+   FramePtr _frame;
+   Packet _packet;
+
+   // the source and sink contexts belong to the graph
+   AVFilterContext *_buffersinkCtx = nullptr;
+   AVFilterContext *_buffersrcCtx = nullptr;
+   std::unique_ptr<ConfiguredGraph> _graph;
+
+   int _videoStreamIndex = -1;
+   std::vector<AVStream*> _audioStreams;
+   PacketRefs _audioPackets;
+   // end of input: the decoder is drained with empty packets, then the graph
+   // input is closed and its sink drained
+   enum { READING, FLUSHING_DECODER, FLUSHING_GRAPH, FINISHED } _state = READING;
+   int64_t _lastPts = AV_NOPTS_VALUE;
+   // input frames fed to the graph, and the last resume points: every
+   // _rebuildFrames-th frame, the oldest is far enough back for the frames
+   // leaving the graph now; none when the window is unknown
+   int64_t _inputFrames = 0;
+   int _rebuildFrames = 0;
+   std::deque<std::pair<int64_t, int64_t>> _resumePoints;
+   // after resumeFrom, the decoded frames before this pts are not fed
+   int64_t _resumePts = AV_NOPTS_VALUE;
+   bool _borrowFrames = false;
+   int64_t _bytesCopied = 0;
+   ShmRingWriter *_frameRing = nullptr;
+   std::shared_ptr<FrameAllocator> _allocator;
+   std::unique_ptr<PerfStats> _perf;
+   std::unique_ptr<ChecksumWriter> _checksums;
+   enum { PERF_DEMUX, PERF_DECODE, PERF_FILTER };
+   // read time of the packets of the frames inside the decoder and graph, by pts
+   std::map<int64_t, Clock::time_point> _inputTimes;
+
+   Images _images;
+};
+
+#endif // FILTER_H
@@ -0,0 +1,101 @@
+#include "frameallocator.h"
+
+#include <stdexcept>
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+FrameAllocator::FrameAllocator(const FrameAllocatorConfig& config)
+: _config(config)
+, _node(config.node >= 0 ? config.node : currentNode())
+{
+}
+
+FrameAllocator::~FrameAllocator()
+{
+   for (auto mapping(_lengths.begin()); mapping != _lengths.end(); ++mapping)
+      munmap(mapping->first, mapping->second);
+}
+
+int FrameAllocator::currentNode()
+{
+   unsigned cpu(0), node(0);
+   if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+      return 0;
+   return node;
+}
+
+size_t FrameAllocator::mappedLength(size_t size) const
+{
+   size_t page = _config.pages == FrameAllocatorConfig::NORMAL ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+   return (size + page - 1) / page * page;
+}
+
+uint8_t *FrameAllocator::allocate(size_t size)
+{
+   size_t length = mappedLength(size);
+   std::lock_guard<std::mutex> lock(_mutex);
+   std::vector<uint8_t*>& free = _free[length];
+   if (!free.empty()) {
+      uint8_t *buffer = free.back();
+      free.pop_back();
+      return buffer;
+   }
+   uint8_t *buffer = map(length);
+   _lengths[buffer] = length;
+   ++_mappings;
+   _bytesMapped += length;
+   return buffer;
+}
+
+void FrameAllocator::release(uint8_t *buffer, size_t size)
+{
+   if (!buffer)
+      return;
+   std::lock_guard<std::mutex> lock(_mutex);
+   _free[mappedLength(size)].push_back(buffer);
+}
+
+uint8_t *FrameAllocator::map(size_t length)
+{
+   void *addr = MAP_FAILED;
+   if (_config.pages == FrameAllocatorConfig::EXPLICIT) {
+      addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      // the hugetlbfs pool is reserved by the administrator and may be empty
+      if (addr == MAP_FAILED)
+         ++_hugePageFallbacks;
+   }
+   if (addr == MAP_FAILED && _config.pages == FrameAllocatorConfig::NORMAL) {
+      addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (addr == MAP_FAILED)
+         throw std::runtime_error("Could not map frame buffer");
+   }
+   else if (addr == MAP_FAILED) {
+      // transparent huge pages only back 2 MB aligned ranges: over-map and trim
+      size_t span = length + HUGE_PAGE_SIZE;
+      uint8_t *base = static_cast<uint8_t*>(mmap(NULL, span, PROT_READ | PROT_WRITE,
+                                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (base == MAP_FAILED)
+         throw std::runtime_error("Could not map frame buffer");
+      uint8_t *aligned = reinterpret_cast<uint8_t*>(
+            (reinterpret_cast<uintptr_t>(base) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+      if (aligned != base)
+         munmap(base, aligned - base);
+      if (base + span != aligned + length)
+         munmap(aligned + length, base + span - (aligned + length));
+      addr = aligned;
+      madvise(addr, length, MADV_HUGEPAGE);
+   }
+
+   // pages are placed on first touch: set the policy before anything writes them
+   if (_node < (int)(8 * sizeof(unsigned long))) {
+      unsigned long nodemask = 1UL << _node;
+      syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask), 0);
+   }
+   return static_cast<uint8_t*>(addr);
+}
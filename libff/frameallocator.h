@@ -0,0 +1,63 @@
+#ifndef FRAMEALLOCATOR_H
+#define FRAMEALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct FrameAllocatorConfig
+{
+   enum Pages
+   {
+      NORMAL,        // 4 KB pages
+      TRANSPARENT,   // madvise(MADV_HUGEPAGE), the kernel backs what it can with 2 MB pages
+      EXPLICIT       // MAP_HUGETLB from the reserved pool, transparent when it is empty
+   };
+   Pages pages = TRANSPARENT;
+   // NUMA node the frames are bound to, -1 for the node of the allocating thread
+   int node = -1;
+};
+
+// Page backed frame buffers. Uncompressed frames are a few MB each: mapped
+// on huge pages they need a handful of TLB entries instead of hundreds, and
+// bound to the node of the thread that processes them they never cross the
+// interconnect. Buffers are cache line (64 byte) aligned and recycled by
+// size, so steady state allocation is a free list pop.
+class FrameAllocator
+{
+public:
+   static const size_t ALIGNMENT = 64;
+
+   FrameAllocator(const FrameAllocatorConfig& config = FrameAllocatorConfig());
+   virtual ~FrameAllocator();
+   uint8_t *allocate(size_t size);
+   void release(uint8_t *buffer, size_t size);
+
+   // buffers mapped, and those that wanted explicit huge pages and did not get them
+   int mappings() const { return _mappings; }
+   int hugePageFallbacks() const { return _hugePageFallbacks; }
+   size_t bytesMapped() const { return _bytesMapped; }
+   int node() const { return _node; }
+
+   // node of the CPU the calling thread runs on, 0 without NUMA
+   static int currentNode();
+
+private:
+   FrameAllocator(const FrameAllocator&);
+   FrameAllocator& operator=(const FrameAllocator&);
+   uint8_t *map(size_t length);
+   size_t mappedLength(size_t size) const;
+
+   FrameAllocatorConfig _config;
+   int _node;
+   std::mutex _mutex;
+   std::map<size_t, std::vector<uint8_t*>> _free;
+   std::map<uint8_t*, size_t> _lengths;
+   int _mappings = 0;
+   int _hugePageFallbacks = 0;
+   size_t _bytesMapped = 0;
+};
+
+#endif // FRAMEALLOCATOR_H
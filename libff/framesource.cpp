@@ -0,0 +1,155 @@
+#include "framesource.h"
+#include "filter.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+FrameSource frames(Filter& filter)
+{
+   return [&filter]() { return filter.readVideoFrame(); };
+}
+
+FrameSource take(FrameSource source, int64_t count)
+{
+   std::shared_ptr<int64_t> left(new int64_t(count));
+   return [source, left]() -> Image {
+      if (*left <= 0)
+         return nullptr;
+      Image image = source();
+      *left = image ? *left - 1 : 0;
+      return image;
+   };
+}
+
+FrameSource stride(FrameSource source, int step)
+{
+   step = std::max(1, step);
+   return [source, step]() -> Image {
+      Image image = source();
+      // the frames in between are pulled and dropped, the next call starts
+      // on the frame after them
+      for (int skip(1); image && skip < step; ++skip)
+         if (!source())
+            break;
+      return image;
+   };
+}
+
+BatchSource window(FrameSource source, int size)
+{
+   size = std::max(1, size);
+   return [source, size]() {
+      Images images;
+      images.reserve(size);
+      while ((int)images.size() < size) {
+         Image image = source();
+         if (!image)
+            break;
+         images.push_back(image);
+      }
+      return images;
+   };
+}
+
+namespace {
+
+// The producer thread of prefetch and the frames it queued. Destroyed with
+// the last copy of the returned source, which stops and joins the thread.
+class Prefetcher
+{
+public:
+   Prefetcher(FrameSource source, int depth)
+   : _source(source)
+   , _depth(std::max(1, depth))
+   {
+      _thread = std::thread(&Prefetcher::run, this);
+   }
+
+   ~Prefetcher()
+   {
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         _closing = true;
+      }
+      _cond.notify_all();
+      _thread.join();
+   }
+
+   Image next()
+   {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cond.wait(lock, [&] { return !_frames.empty() || _finished; });
+      if (_frames.empty()) {
+         if (_error) {
+            std::exception_ptr error = _error;
+            _error = nullptr;
+            std::rethrow_exception(error);
+         }
+         return nullptr;
+      }
+      Image image = _frames.front();
+      _frames.pop_front();
+      _cond.notify_all();
+      return image;
+   }
+
+private:
+   void run()
+   {
+      Trace::setThreadName("prefetch");
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;) {
+         _cond.wait(lock, [&] { return (int)_frames.size() < _depth || _closing; });
+         if (_closing)
+            break;
+         lock.unlock();
+         Image image;
+         std::exception_ptr error;
+         try {
+            image = _source();
+         }
+         catch (...) {
+            error = std::current_exception();
+         }
+         if (image && image->ref) {
+            // dropped here, on the thread that pulls the graph
+            image = nullptr;
+            error = std::make_exception_ptr(std::runtime_error("Cannot prefetch borrowed frames"));
+         }
+         lock.lock();
+         if (!image) {
+            _error = error;
+            break;
+         }
+         _frames.push_back(image);
+         _cond.notify_all();
+      }
+      _finished = true;
+      _cond.notify_all();
+   }
+
+   FrameSource _source;
+   const int _depth;
+   std::deque<Image> _frames;
+   std::exception_ptr _error;
+   bool _finished = false;
+   bool _closing = false;
+   std::mutex _mutex;
+   std::condition_variable _cond;
+   std::thread _thread;
+};
+
+}
+
+FrameSource prefetch(FrameSource source, int depth)
+{
+   std::shared_ptr<Prefetcher> prefetcher(new Prefetcher(source, depth));
+   return [prefetcher]() { return prefetcher->next(); };
+}
@@ -0,0 +1,76 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include "image.h"
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+
+class Filter;
+
+// Pull-style frame sequences. Each call of a FrameSource returns the next
+// frame, nullptr at the end and on every call after it; a BatchSource does
+// the same with batches, ending with an empty one. Sources compose:
+//
+//    for (const Image& image : FrameRange(stride(take(frames(filter), 250), 5)))
+//       ...
+//
+// Nothing is read ahead unless asked for with prefetch, a source costs one
+// indirect call per frame over calling Filter::readVideoFrame in a loop.
+typedef std::function<Image()> FrameSource;
+typedef std::function<Images()> BatchSource;
+
+// The frames of filter through to the end of the input, the frames the
+// decoder and the graph hold back included.
+FrameSource frames(Filter& filter);
+// The first count frames of source.
+FrameSource take(FrameSource source, int64_t count);
+// Every step-th frame of source, starting with the first.
+FrameSource stride(FrameSource source, int step);
+// Consecutive batches of size frames, the last one may be shorter.
+BatchSource window(FrameSource source, int size);
+// Pulls source on a thread of its own, up to depth frames ahead, so reading
+// and decoding overlap whatever the caller does with the frames. source
+// must not be pulled from anywhere else meanwhile; an exception it throws
+// is rethrown by the call that would have returned the frame. The frames
+// must own their planes: borrowed ones (Filter::setBorrowFrames) would go
+// back to the graph on the caller's thread while the prefetch thread runs
+// it, so they end the source with an error.
+FrameSource prefetch(FrameSource source, int depth = 8);
+
+// Input range over a source, for range-based for loops.
+class FrameRange
+{
+public:
+   class iterator : public std::iterator<std::input_iterator_tag, Image>
+   {
+   public:
+      iterator() {}
+      explicit iterator(FrameSource *source) : _source(source) { ++*this; }
+      const Image& operator*() const { return _image; }
+      const Image *operator->() const { return &_image; }
+      iterator& operator++()
+      {
+         _image = (*_source)();
+         if (!_image)
+            _source = nullptr;
+         return *this;
+      }
+      bool operator==(const iterator& other) const { return _source == other._source; }
+      bool operator!=(const iterator& other) const { return _source != other._source; }
+
+   private:
+      FrameSource *_source = nullptr;
+      Image _image;
+   };
+
+   explicit FrameRange(FrameSource source) : _source(source) {}
+   iterator begin() { return iterator(&_source); }
+   iterator end() { return iterator(); }
+
+private:
+   FrameSource _source;
+};
+
+#endif // FRAMESOURCE_H
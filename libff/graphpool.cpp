@@ -0,0 +1,190 @@
+#include "graphpool.h"
+#include "latency.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+
+bool GraphKey::operator<(const GraphKey& other) const
+{
+   return std::tie(description, width, height, pixFmt, timeBase.num, timeBase.den,
+                   sampleAspect.num, sampleAspect.den, sinkFmt)
+        < std::tie(other.description, other.width, other.height, other.pixFmt,
+                   other.timeBase.num, other.timeBase.den,
+                   other.sampleAspect.num, other.sampleAspect.den, other.sinkFmt);
+}
+
+GraphPool::GraphPool(int spares, int total)
+: _spares(std::max(1, spares))
+, _total(std::max(_spares, total))
+{
+   _builder = std::thread(&GraphPool::run, this);
+}
+
+GraphPool::~GraphPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closing = true;
+   }
+   _cond.notify_all();
+   _builder.join();
+}
+
+std::unique_ptr<ConfiguredGraph> GraphPool::acquire(const GraphKey& key)
+{
+   std::unique_ptr<ConfiguredGraph> graph;
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto spares = _graphs.find(key);
+      if (spares != _graphs.end()) {
+         graph = std::move(spares->second.graphs.back());
+         spares->second.graphs.pop_back();
+         spares->second.used = ++_uses;
+         if (spares->second.graphs.empty())
+            _graphs.erase(spares);
+         graph->prebuilt = true;
+         --_count;
+         ++_hits;
+      }
+      else
+         ++_misses;
+      _pending.push_back(key);
+   }
+   _cond.notify_all();
+   if (!graph)
+      graph = build(key);
+   return graph;
+}
+
+int GraphPool::hits() const
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   return _hits;
+}
+
+int GraphPool::misses() const
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   return _misses;
+}
+
+int GraphPool::evictions() const
+{
+   std::lock_guard<std::mutex> lock(_mutex);
+   return _evictions;
+}
+
+void GraphPool::run()
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   for (;;) {
+      _cond.wait(lock, [&] { return !_pending.empty() || _closing; });
+      if (_closing)
+         return;
+      GraphKey key = _pending.front();
+      _pending.pop_front();
+      auto spares = _graphs.find(key);
+      if (spares != _graphs.end() && (int)spares->second.graphs.size() >= _spares)
+         continue;
+
+      lock.unlock();
+      std::unique_ptr<ConfiguredGraph> graph;
+      try {
+         graph = build(key);
+      }
+      catch (std::exception& e) {
+         // acquire builds in the foreground and reports the error to the job
+         fprintf(stderr, "Could not build a spare filter graph: %s\n", e.what());
+      }
+      lock.lock();
+      if (!graph)
+         continue;
+      Spares& entry = _graphs[key];
+      entry.graphs.push_back(std::move(graph));
+      entry.used = ++_uses;
+      ++_count;
+      std::vector<std::unique_ptr<ConfiguredGraph>> evicted;
+      evict(evicted);
+      // freed without holding up acquire
+      lock.unlock();
+      evicted.clear();
+      lock.lock();
+   }
+}
+
+// Takes spares of the least recently used keys out until the pool is back
+// within its total.
+void GraphPool::evict(std::vector<std::unique_ptr<ConfiguredGraph>>& evicted)
+{
+   while (_count > _total) {
+      auto oldest = _graphs.begin();
+      for (auto it(_graphs.begin()); it != _graphs.end(); ++it) {
+         if (it->second.used < oldest->second.used)
+            oldest = it;
+      }
+      evicted.push_back(std::move(oldest->second.graphs.back()));
+      oldest->second.graphs.pop_back();
+      if (oldest->second.graphs.empty())
+         _graphs.erase(oldest);
+      --_count;
+      ++_evictions;
+   }
+}
+
+std::unique_ptr<ConfiguredGraph> GraphPool::build(const GraphKey& key)
+{
+   Clock::time_point start = Clock::now();
+   std::unique_ptr<ConfiguredGraph> configured(new ConfiguredGraph);
+
+   // buffer video source: the decoded frames from the decoder will be inserted here.
+   // the decoded pts are in the stream time base, the graph must know it to give frames a time
+   char args[512];
+   snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+            key.width, key.height, key.pixFmt, key.timeBase.num, key.timeBase.den,
+            key.sampleAspect.num, key.sampleAspect.den);
+
+   configured->graph.reset(avfilter_graph_alloc());
+   AVFilterGraph *graph = configured->graph.get();
+   if (!graph)
+      throw std::runtime_error("Could not allocate filter graph");
+   AVFilter *buffersrc  = avfilter_get_by_name("buffer");
+   if (avfilter_graph_create_filter(&configured->source, buffersrc, "in", args, NULL, graph) < 0)
+      throw std::runtime_error("Could not create buffer source\n");
+
+   // buffer video sink: to terminate the filter chain. The sink copies the
+   // parameters, they are ours to free.
+   AvMallocPtr<AVBufferSinkParams> buffersinkParams(av_buffersink_params_alloc());
+   enum AVPixelFormat pix_fmts[] = { key.sinkFmt, AV_PIX_FMT_NONE };
+   buffersinkParams->pixel_fmts = pix_fmts;
+   AVFilter *buffersink = avfilter_get_by_name("ffbuffersink");
+   if (avfilter_graph_create_filter(&configured->sink, buffersink, "out", NULL, buffersinkParams.get(),
+                                    graph) < 0)
+      throw std::runtime_error("Could not create buffer sink\n");
+
+   // Endpoints for the filter graph, parsing consumes the ones it links.
+   FilterInOutPtr inputs(avfilter_inout_alloc());
+   FilterInOutPtr outputs(avfilter_inout_alloc());
+   if (!inputs || !outputs)
+      throw std::runtime_error("Could not allocate filter graph endpoints");
+   inputs->name       = av_strdup("out");
+   inputs->filter_ctx = configured->sink;
+   inputs->pad_idx    = 0;
+   inputs->next       = NULL;
+   outputs->name       = av_strdup("in");
+   outputs->filter_ctx = configured->source;
+   outputs->pad_idx    = 0;
+   outputs->next       = NULL;
+   AVFilterInOut *in = inputs.release(), *out = outputs.release();
+   int ret = avfilter_graph_parse(graph, key.description.c_str(), &in, &out, NULL);
+   inputs.reset(in);
+   outputs.reset(out);
+   if (ret < 0)
+      throw std::runtime_error("Could not parse filter graph");
+   if (avfilter_graph_config(graph, NULL) < 0)
+      throw std::runtime_error("Could not validate links and formats in the graph");
+
+   configured->setupSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+   return configured;
+}
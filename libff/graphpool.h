@@ -0,0 +1,95 @@
+#ifndef GRAPHPOOL_H
+#define GRAPHPOOL_H
+
+#include "avptr.h"
+#include "libav.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What a configured graph depends on: the filters and the buffer source
+// and sink parameters.
+struct GraphKey
+{
+   std::string description;
+   int width = 0;
+   int height = 0;
+   enum AVPixelFormat pixFmt = AV_PIX_FMT_NONE;
+   AVRational timeBase = {0, 1};
+   AVRational sampleAspect = {0, 1};
+   enum AVPixelFormat sinkFmt = AV_PIX_FMT_NONE;
+
+   bool operator<(const GraphKey& other) const;
+};
+
+// A parsed and configured graph with its buffer source and sink.
+struct ConfiguredGraph
+{
+   FilterGraphPtr graph;
+   AVFilterContext *source = nullptr;
+   AVFilterContext *sink = nullptr;
+   // time taken by avfilter_graph_parse and avfilter_graph_config
+   double setupSeconds = 0.;
+   // built ahead as a spare, the job didn't wait for it
+   bool prebuilt = false;
+};
+
+// Configured graphs ready to be handed to the next input. libavfilter has
+// no way to reset a graph: yadif and decimate keep frames of the previous
+// input, so a graph is never reused. Instead every graph taken is replaced
+// by a fresh spare built on a background thread, and a job with the same
+// parameters as an earlier one starts without waiting for parse and config.
+// Spares of keys that stopped coming are dropped, least recently used first,
+// once the pool holds more than its total.
+class GraphPool
+{
+public:
+   // Keeps spares graphs per key, at most total across keys.
+   GraphPool(int spares = 1, int total = 8);
+   virtual ~GraphPool();
+   // A spare when there is one for key, else a graph built now. Either way
+   // a replacement spare is queued.
+   std::unique_ptr<ConfiguredGraph> acquire(const GraphKey& key);
+   int hits() const;
+   int misses() const;
+   int evictions() const;
+
+   static std::unique_ptr<ConfiguredGraph> build(const GraphKey& key);
+
+private:
+   GraphPool(const GraphPool&);
+   GraphPool& operator=(const GraphPool&);
+   void run();
+   void evict(std::vector<std::unique_ptr<ConfiguredGraph>>& evicted);
+
+   struct Spares
+   {
+      std::vector<std::unique_ptr<ConfiguredGraph>> graphs;
+      // _uses when the key was last acquired or given a spare
+      uint64_t used = 0;
+   };
+
+   const int _spares;
+   const int _total;
+   std::map<GraphKey, Spares> _graphs;
+   int _count = 0;
+   uint64_t _uses = 0;
+   // keys that are short of spares, in request order
+   std::deque<GraphKey> _pending;
+   int _hits = 0;
+   int _misses = 0;
+   int _evictions = 0;
+   bool _closing = false;
+   mutable std::mutex _mutex;
+   std::condition_variable _cond;
+   std::thread _builder;
+};
+
+#endif // GRAPHPOOL_H
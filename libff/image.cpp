@@ -0,0 +1,22 @@
+#include "image.h"
+
+#include <stdexcept>
+
+int allocImage(uint8_t *data[4], int linesizes[4], int width, int height,
+               enum AVPixelFormat pixFmt, FrameAllocator& allocator)
+{
+   if (av_image_fill_linesizes(linesizes, pixFmt, width) < 0)
+      throw std::runtime_error("Could not compute image line sizes");
+   for (int plane(0); plane < 4; ++plane)
+      linesizes[plane] = FFALIGN(linesizes[plane], (int)FrameAllocator::ALIGNMENT);
+   // aligned lines keep every plane start aligned as well
+   int size = av_image_fill_pointers(data, pixFmt, height, NULL, linesizes);
+   if (size < 0)
+      throw std::runtime_error("Could not compute image size");
+   av_image_fill_pointers(data, pixFmt, height, allocator.allocate(size), linesizes);
+   return size;
+}
+
+//Image::Image()
+//{
+//}
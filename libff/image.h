@@ -0,0 +1,64 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "frameallocator.h"
+#include "latency.h"
+#include "libav.h"
+
+#include <memory>
+#include <vector>
+
+struct ImageImpl
+{
+   uint8_t *data[4] = {nullptr};
+   int linesizes[4] = {0};
+   int width = 0;
+   int height = 0;
+   // presentation time from the start of the input, in seconds
+   double time = 0.;
+   // filtered pts, in the filter graph output time base
+   int64_t pts = AV_NOPTS_VALUE;
+   // repeats the previous frame within the DuplicateDetector threshold
+   bool duplicate = false;
+   // when the input packet this frame came from was read
+   Clock::time_point inputTime;
+   // input frame number and pts the filter can restart from and still give
+   // this frame and the ones after it, see Filter::resumeFrom
+   int64_t resumeFrame = 0;
+   int64_t resumePts = AV_NOPTS_VALUE;
+   // set when data borrows the planes of a filter buffer instead of owning a copy
+   AVFilterBufferRef *ref = nullptr;
+   // set when data is a buffer of allocSize bytes from this allocator
+   std::shared_ptr<FrameAllocator> allocator;
+   size_t allocSize = 0;
+
+   ~ImageImpl() {
+//      free(data);
+//      delete [] data;
+      if (ref)
+         avfilter_unref_bufferp(&ref);
+      else if (allocator)
+         allocator->release(data[0], allocSize);
+      else
+         av_freep(&data[0]);
+   }
+};
+
+// Lays out a width x height pix_fmt picture in one allocator buffer, with
+// every line starting on a FrameAllocator::ALIGNMENT boundary. Returns the
+// buffer size.
+int allocImage(uint8_t *data[4], int linesizes[4], int width, int height,
+               enum AVPixelFormat pixFmt, FrameAllocator& allocator);
+
+typedef std::shared_ptr<ImageImpl> Image;
+typedef std::vector<Image> Images;
+//typedef std::vector<StructImage> StructImages;
+
+
+//class Image
+//{
+//public:
+//   Image();
+//};
+
+#endif // IMAGE_H
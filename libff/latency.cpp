@@ -0,0 +1,33 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+
+void LatencyStats::add(Clock::time_point since, Clock::time_point now)
+{
+   _samples.push_back(std::chrono::duration<double, std::milli>(now - since).count());
+   _sorted = false;
+}
+
+double LatencyStats::percentile(double p) const
+{
+   if (_samples.empty())
+      return 0.;
+   if (!_sorted) {
+      std::sort(_samples.begin(), _samples.end());
+      _sorted = true;
+   }
+   // nearest rank
+   size_t rank = (size_t)std::ceil(p / 100. * _samples.size());
+   return _samples[std::min(_samples.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+void LatencyStats::report(std::ostream& os, const char *name) const
+{
+   os <<name <<" latency over " <<count() <<" frames:"
+      <<" p50 " <<percentile(50.) <<" ms"
+      <<", p90 " <<percentile(90.) <<" ms"
+      <<", p99 " <<percentile(99.) <<" ms"
+      <<", max " <<max() <<" ms" <<std::endl;
+}
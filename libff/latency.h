@@ -0,0 +1,26 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <chrono>
+#include <iosfwd>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// Collects latency samples in milliseconds and reports percentiles.
+class LatencyStats
+{
+public:
+   void add(Clock::time_point since, Clock::time_point now = Clock::now());
+   void add(double ms) { _samples.push_back(ms); _sorted = false; }
+   size_t count() const { return _samples.size(); }
+   double percentile(double p) const;
+   double max() const { return percentile(100.); }
+   void report(std::ostream& os, const char *name) const;
+
+private:
+   mutable std::vector<double> _samples;
+   mutable bool _sorted = false;
+};
+
+#endif // LATENCY_H
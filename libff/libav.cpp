@@ -0,0 +1,41 @@
+#include "libav.h"
+
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+static std::once_flag initFlag;
+
+// libavcodec creates, locks and destroys its global codec lock and the
+// network lock through this callback.
+static int lockManager(void **lock, enum AVLockOp op)
+{
+   switch (op) {
+   case AV_LOCK_CREATE:
+      *lock = new (std::nothrow) std::mutex;
+      return *lock ? 0 : 1;
+   case AV_LOCK_OBTAIN:
+      static_cast<std::mutex*>(*lock)->lock();
+      return 0;
+   case AV_LOCK_RELEASE:
+      static_cast<std::mutex*>(*lock)->unlock();
+      return 0;
+   case AV_LOCK_DESTROY:
+      delete static_cast<std::mutex*>(*lock);
+      *lock = NULL;
+      return 0;
+   }
+   return 1;
+}
+
+void initLibav()
+{
+   std::call_once(initFlag, [] {
+      if (av_lockmgr_register(lockManager) < 0)
+         throw std::runtime_error("Could not register the libav lock manager");
+      avcodec_register_all();
+      av_register_all();
+      avfilter_register_all();
+      avformat_network_init();
+   });
+}
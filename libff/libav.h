@@ -18,4 +18,10 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
+// Registers the codecs, formats and filters and installs the lock manager
+// that makes avcodec_open2 and avcodec_close safe from concurrent threads.
+// Runs once per process whatever the number of callers and threads; every
+// class of the library calls it before touching libav.
+void initLibav();
+
 #endif // LIBAV_H
@@ -0,0 +1,13 @@
+# Builds against libff: include after ff.prf, the library must precede the
+# libav libraries it uses on the link line.
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+LIBS = -L$$OUT_PWD/../libff -lff -lrt $$LIBS
+equals(LIBFF_LINK, static) {
+   PRE_TARGETDEPS += $$OUT_PWD/../libff/libff.a
+} else {
+   PRE_TARGETDEPS += $$OUT_PWD/../libff/libff.so
+   # the tools run from the build tree
+   QMAKE_RPATHDIR += $$OUT_PWD/../libff
+}
@@ -0,0 +1,66 @@
+TEMPLATE = lib
+TARGET = ff
+CONFIG -= qt
+
+include(../ff.prf)
+
+# LIBFF_LINK in ff.prf picks libff.a or libff.so, libff.pri follows it
+equals(LIBFF_LINK, static): CONFIG += staticlib
+
+SOURCES += \
+    allocations.cpp \
+    bandpass.cpp \
+    cancel.cpp \
+    checkpoint.cpp \
+    checksum.cpp \
+    demuxer.cpp \
+    duplicates.cpp \
+    encoderpool.cpp \
+    fanout.cpp \
+    muxer.cpp \
+    filter.cpp \
+    frameallocator.cpp \
+    framesource.cpp \
+    graphpool.cpp \
+    image.cpp \
+    latency.cpp \
+    libav.cpp \
+    packetpool.cpp \
+    perfcounters.cpp \
+    qualitymonitor.cpp \
+    placement.cpp \
+    shmring.cpp \
+    statistics.cpp \
+    streamio.cpp \
+    thumbnailer.cpp \
+    trace.cpp
+
+HEADERS += \
+    allocations.h \
+    avptr.h \
+    bandpass.h \
+    cancel.h \
+    checkpoint.h \
+    checksum.h \
+    demuxer.h \
+    duplicates.h \
+    encoderpool.h \
+    fanout.h \
+    muxer.h \
+    filter.h \
+    frameallocator.h \
+    framesource.h \
+    graphpool.h \
+    config.h \
+    image.h \
+    latency.h \
+    packetpool.h \
+    perfcounters.h \
+    qualitymonitor.h \
+    placement.h \
+    shmring.h \
+    statistics.h \
+    streamio.h \
+    thumbnailer.h \
+    trace.h \
+    libav.h
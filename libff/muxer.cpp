@@ -0,0 +1,955 @@
+#include "muxer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <exception>
+#include <stdexcept>
+
+#include <unistd.h>
+
+using namespace std;
+
+Muxer::Muxer(const char *dst, const MuxerConfig& config)
+: _filename(dst)
+, _config(config)
+, _interrupt(config.cancel, config.ioTimeout)
+{
+   init();
+}
+
+Muxer::~Muxer()
+{
+   close();
+   // a held packet the encoder allocated, pool buffers go with the pool
+   av_free_packet(&_lastPacket);
+}
+
+void Muxer::init()
+{
+   // Initialize libavcodec, and register all codecs and formats
+   initLibav();
+
+   if (StreamIO::isStream(_filename) && _config.fragmentDuration <= 0)
+      _config.fragmentDuration = STREAM_FRAGMENT_DURATION;
+   if (_config.checkpointInterval > 0 || _config.resume) {
+      // a checkpoint is a fragment boundary in a file we can truncate
+      if (StreamIO::isStream(_filename))
+         throw std::runtime_error("Checkpoints need a file output");
+      if (_config.fragmentDuration <= 0)
+         _config.fragmentDuration = STREAM_FRAGMENT_DURATION;
+   }
+
+   // allocate the output media context
+   _fmt = av_guess_format(_config.format, NULL, NULL);
+   AVFormatContext *oc = NULL;
+   avformat_alloc_output_context2(&oc, _fmt, NULL, _filename);
+   if (!oc) {
+      std::cout <<"Could not deduce output format from file extension: using MPEG" <<std::endl;
+      avformat_alloc_output_context2(&oc, NULL, "mpeg", _filename);
+   }
+   if (!oc)
+      throw std::runtime_error("Could not open the context");
+   _oc.reset(oc);
+   // every write gives up on cancel or timeout instead of blocking on a
+   // stalled pipe or disk
+   _oc->interrupt_callback = _interrupt.callback();
+
+   _fmt = _oc->oformat;
+
+   // Add the video stream using the configured codec, or the format
+   // default codec, and initialize the codec
+   enum AVCodecID codecId = _config.codec != AV_CODEC_ID_NONE ? _config.codec : _fmt->video_codec;
+   if (codecId != AV_CODEC_ID_NONE)
+      _videoSt = addStream(codecId);
+   for (auto audio(_config.audioStreams.begin()); audio != _config.audioStreams.end(); ++audio)
+      addAudioStream(*audio);
+
+   // Now that all the parameters are set, we can open the
+   // video codecs and allocate the necessary encode buffers
+   if (_videoSt)
+      openVideo();
+
+   av_dump_format(_oc.get(), 0, _filename, 1);
+
+   // open the output file, if needed
+   if (_config.resume) {
+      // the muxer writes the output again up to the checkpoint, see resumeOutput
+      _replay.reset(new OutputReplay(_filename, _config.resume->offset));
+      _oc->pb = _replay->sink();
+      _oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+   }
+   else if (StreamIO::isStream(_filename)) {
+      _output.reset(new StreamIO(_filename, true));
+      _output->setInterruptCallback(_interrupt.callback());
+      _oc->pb = _output->context();
+      // ours to close, not the format context's
+      _oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+   }
+   else if (!(_fmt->flags & AVFMT_NOFILE)) {
+      int ret;
+      {
+         IoInterrupt::Operation operation(_interrupt);
+         ret = avio_open2(&_oc->pb, _filename, AVIO_FLAG_WRITE, &_oc->interrupt_callback, NULL);
+      }
+      if (ret < 0) {
+         _interrupt.check("opening the output");
+         throw std::runtime_error("Could not open file");
+      }
+   }
+
+   AVDictionary *options = NULL;
+   if (_config.fragmentDuration > 0) {
+      // frag_custom lets flushFragment() close a fragment on demand
+      char duration[32];
+      snprintf(duration, sizeof(duration), "%lld", _config.fragmentDuration * 1000LL);
+      av_dict_set(&options, "movflags", "empty_moov+frag_custom", 0);
+      av_dict_set(&options, "frag_duration", duration, 0);
+   }
+
+   // Write the stream header, if any.
+   int ret;
+   {
+      IoInterrupt::Operation operation(_interrupt);
+      ret = avformat_write_header(_oc.get(), &options);
+   }
+   av_dict_free(&options);
+   if (ret < 0) {
+      _interrupt.check("writing the output header");
+      throw std::runtime_error("Error occurred when opening output file");
+   }
+
+   if (_config.fragmentDuration > 0) {
+      avio_flush(_oc->pb);
+      _flushedPos = avio_tell(_oc->pb);
+   }
+
+   if (_frame)
+      _frame->pts = 0;
+   _firstDts.assign(_oc->nb_streams, AV_NOPTS_VALUE);
+   _resumeDts.assign(_oc->nb_streams, AV_NOPTS_VALUE);
+   if (_config.checkpointInterval > 0)
+      _checkpointFrames = std::max<int64_t>(1, av_rescale(_config.checkpointInterval, _config.frameRate.num,
+                                                          _config.frameRate.den * 1000LL));
+   if (_replay)
+      resumeOutput();
+   if (!_config.checksums.empty())
+      _checksums.reset(new ChecksumWriter(_config.checksums, "encoder input"));
+
+}
+
+void Muxer::close()
+{
+   if (_closed)
+      return;
+   _closed = true;
+   // Write the trailer, if any. The trailer must be written before you close
+   // the CodecContexts open when you wrote the header; otherwise av_write_trailer()
+   // may try to use memory that was freed on av_codec_close()
+   // The frames a delaying encoder still holds come first, unless closing on
+   // an error: the output is incomplete then anyway.
+   if (!_rawVideo && !std::uncaught_exception()) {
+      try {
+         drainEncoder();
+      }
+      catch (std::exception& e) {
+         std::cerr <<"Could not write the last video frames: " <<e.what() <<std::endl;
+      }
+   }
+   if (!_heldAudio.empty()) {
+      try {
+         writeHeldAudio(AV_NOPTS_VALUE);
+      }
+      catch (std::exception& e) {
+         std::cerr <<"Could not write the last audio packets: " <<e.what() <<std::endl;
+      }
+   }
+   int ret;
+   {
+      // once cancelled the interrupt fails the writes right away, a
+      // cancelled output is incomplete anyway
+      IoInterrupt::Operation operation(_interrupt);
+      ret = av_write_trailer(_oc.get());
+   }
+   // complete: nothing left to resume, unless we are closing on an error
+   if (ret >= 0 && _checkpointFrames && !std::uncaught_exception())
+      remove(_config.checkpoint.c_str());
+   if (_config.fragmentDuration > 0) {
+      avio_flush(_oc->pb);
+      for (auto arrival(_unflushed.begin()); arrival != _unflushed.end(); ++arrival)
+         _diskLatency.add(*arrival);
+      _unflushed.clear();
+   }
+   // Intra-only encoders keep nothing from one frame to the next, flushed
+   // they serve the next output as if new. Others hold rate control and
+   // reference state that avcodec_flush_buffers doesn't reset in every
+   // encoder; they are closed.
+   if (_pooledEncoder && _intraOnly && _arrivals.empty())
+      _config.encoders->release(_encoderKey, std::move(_pooledEncoder));
+   // the members release the rest: the codec, then the file and the
+   // context, then the stream output that flushes on destruction
+}
+
+int64_t Muxer::bytesWritten() const
+{
+   if (_output)
+      return _output->bytes();
+   return _oc->pb ? avio_tell(_oc->pb) : 0;
+}
+
+// Sets the global header of the encoder on the unopened stream context.
+static void copyExtradata(AVCodecContext *dst, const AVCodecContext *src)
+{
+   av_freep(&dst->extradata);
+   dst->extradata_size = 0;
+   if (src->extradata_size <= 0)
+      return;
+   dst->extradata = static_cast<uint8_t*>(av_mallocz(src->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE));
+   if (!dst->extradata)
+      throw std::runtime_error("Could not allocate codec extradata");
+   memcpy(dst->extradata, src->extradata, src->extradata_size);
+   dst->extradata_size = src->extradata_size;
+}
+
+// video output 
+void Muxer::openVideo()
+{
+   // open the codec
+   AVCodecContext *c = _videoSt->codec;
+   AVDictionary *options = encoderOptions();
+   _rawVideo = c->codec_id == AV_CODEC_ID_RAWVIDEO;
+   if (_rawVideo) {
+      // nothing to open: the muxer only needs the picture layout
+      av_dict_free(&options);
+      c->bits_per_coded_sample = av_get_bits_per_pixel(av_pix_fmt_desc_get(c->pix_fmt));
+   }
+   else if (_config.encoders) {
+      // an encoder of our own, not the stream's, so it can outlive this output
+      _encoderKey = EncoderKey::of(c);
+      try {
+         _pooledEncoder = _config.encoders->acquire(_encoderKey, c, _videoCodec, &options);
+      }
+      catch (...) {
+         av_dict_free(&options);
+         throw;
+      }
+      av_dict_free(&options);
+      // the muxer writes its headers from the stream context
+      copyExtradata(c, _pooledEncoder.get());
+      c = _pooledEncoder.get();
+   }
+   else {
+      int ret = avcodec_open2(c, _videoCodec, &options);
+      av_dict_free(&options);
+      if ( ret < 0 )
+         throw std::runtime_error("Could not open video codec");
+      _encoder.reset(c);
+   }
+   _encCtx = c;
+   if (_config.quality.interval > 0 && !_rawVideo)
+      _quality.reset(new QualityMonitor(c, _config.quality));
+   
+   // allocate and init a re-usable frame
+   _frame = allocFrame();
+   
+   // Allocate the encoded raw picture. An uncompressed packet is the whole
+   // picture, it must not have padding between lines or planes.
+   if (_config.allocator && !_rawVideo) {
+      std::shared_ptr<FrameAllocator> allocator(_config.allocator);
+      int size = allocImage(_dstPicture.data, _dstPicture.linesize, c->width, c->height,
+                            c->pix_fmt, *allocator);
+      _dstBuffer = PictureBuffer(_dstPicture.data[0],
+                                 [allocator, size](uint8_t *data) { allocator->release(data, size); });
+   }
+   else if( avpicture_alloc(&_dstPicture, c->pix_fmt, c->width, c->height) <0 )
+      throw std::runtime_error("Could not allocate picture");
+   else
+      _dstBuffer = PictureBuffer(_dstPicture.data[0], [](uint8_t *data) { av_free(data); });
+
+   // DNxHD packets are written into pool buffers: its frame size is fixed by
+   // the bitrate, twice the nominal size is always enough. Other encoders
+   // reserve their worst case in the packet before they encode, often many
+   // times the nominal size, or outgrow it on an intra frame; they allocate
+   // their packets themselves.
+   if (!_rawVideo && c->codec_id == AV_CODEC_ID_DNXHD) {
+      int64_t frameBytes = c->bit_rate / 8 * c->time_base.num / c->time_base.den;
+      if (frameBytes <= 0)
+         frameBytes = avpicture_get_size(c->pix_fmt, c->width, c->height);
+      _packetPool.reserve(2 * frameBytes, PACKET_POOL_SIZE);
+      _pooledPackets = true;
+   }
+
+   // a repeated packet of an intra-only codec decodes to the same picture
+   const AVCodecDescriptor *desc = avcodec_descriptor_get(c->codec_id);
+   _intraOnly = desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+   av_init_packet(&_lastPacket);
+   _lastPacket.data = NULL;
+   _lastPacket.size = 0;
+}
+
+AVDictionary *Muxer::encoderOptions() const
+{
+   AVDictionary *options = NULL;
+   if (_config.lowDelay)
+      // encoders with a lookahead (libx264) take it from their private options
+      av_dict_set(&options, "tune", "zerolatency", 0);
+   return options;
+}
+
+// media file output
+void Muxer::writeVideoFrames(const Images& images)
+{
+   for (auto image(images.begin()); image != images.end(); ++image)
+      writeVideoFrame(*image);
+   //   std::for_each(images.begin(), images.end(), &writeVideoFrame);
+}
+
+void Muxer::writeVideoFrame(const Image& image)
+{
+   _interrupt.checkToken("encoding");
+   if (_resumePts != AV_NOPTS_VALUE) {
+      // in the output before the checkpoint
+      if (image->pts != AV_NOPTS_VALUE && image->pts <= _resumePts)
+         return;
+      _resumePts = AV_NOPTS_VALUE;
+   }
+   if (_countAllocations && _frameCount >= ALLOCATION_WARMUP_FRAMES) {
+      Allocations::Scope scope;
+      int64_t before = Allocations::counted();
+      encodeVideoFrame(image);
+      _steadyAllocations += Allocations::counted() - before;
+      _steadyFrames++;
+   }
+   else
+      encodeVideoFrame(image);
+   if (_checkpointFrames && (_frameCount + _droppedFrames) % _checkpointFrames == 0)
+      checkpoint(image);
+}
+
+void Muxer::encodeVideoFrame(const Image& image)
+{
+   AVCodecContext *c = _encCtx;
+   Clock::time_point arrival = Clock::now();
+   if (!_audioTracks.empty() && _frameCount == 0 && _droppedFrames == 0)
+      // the audio keeps its place on the input timeline, the video starts
+      // where the first frame left by yadif and decimate does
+      _frame->pts = av_rescale_q(llrint(std::max(0., image->time) * AV_TIME_BASE), AV_TIME_BASE_Q,
+                                 _videoSt->time_base);
+   if (!_heldAudio.empty())
+      writeHeldAudio(_frame->pts);
+   if (_config.dropLate > 0 && image->inputTime != Clock::time_point()
+       && arrival - image->inputTime > std::chrono::milliseconds(_config.dropLate)) {
+      // behind real time: skip the frame but keep its slot on the timeline
+      _frame->pts += av_rescale_q(1, c->time_base, _videoSt->time_base);
+      _droppedFrames++;
+      return;
+   }
+   _videoPts = (double)_videoSt->pts.val * _videoSt->time_base.num / _videoSt->time_base.den;
+   if (image->duplicate && _lastPacket.data) {
+      // neither converted nor encoded: the previous packet shows the same picture
+      repeatPacket(arrival);
+      if (_checksums)
+         _checksums->repeat(_frame->pts);
+      if (image->inputTime != Clock::time_point())
+         _muxLatency.add(image->inputTime);
+      _frame->pts += av_rescale_q(1, c->time_base, _videoSt->time_base);
+      _frameCount++;
+      return;
+   }
+   if (_perf && !_perf->opened())
+      _perf->open();
+   Clock::time_point convertStart = Clock::now();
+
+   bool scaled = image->width && (image->width != c->width || image->height != c->height);
+   if (c->pix_fmt != SRC_STREAM_PIX_FMT || scaled || !_pixelStages.empty()) {
+      // the filter delivers SRC_STREAM_PIX_FMT, we must convert it to the codec pixel
+      // format and size; any pixel processing runs in the same banded traversal
+      if (!_bandPass) {
+         int width = image->width ? image->width : c->width;
+         int height = image->height ? image->height : c->height;
+         _bandPass.reset(new BandPass(width, height, SRC_STREAM_PIX_FMT,
+                                      c->width, c->height, c->pix_fmt, _sws_flags, _bandBytes));
+         for (auto stage(_pixelStages.begin()); stage != _pixelStages.end(); ++stage)
+            _bandPass->addStage(*stage);
+      }
+      PerfStats::Scope scope(_perf.get(), PERF_CONVERT);
+      TraceSpan span("convert", image->pts);
+      _bandPass->run(image->data, image->linesizes, _dstPicture.data, _dstPicture.linesize, image->time);
+      for (int i(0); i < 4; ++i) {
+         _frame->data[i] = _dstPicture.data[i];
+         _frame->linesize[i] = _dstPicture.linesize[i];
+      }
+   }
+   else {
+      for (int i(0); i < 4; ++i) {
+         _frame->data[i] = image->data[i];
+         _frame->linesize[i] = image->linesizes[i];
+      }
+   }
+
+   if (_checksums) {
+      TraceSpan span("checksum", image->pts);
+      _checksums->add(_frame->pts, _frame->data, _frame->linesize, c->pix_fmt, c->width, c->height);
+   }
+
+   Clock::time_point encodeStart = Clock::now();
+   _convertSeconds += std::chrono::duration<double>(encodeStart - convertStart).count();
+
+   AVPacket pkt;
+   if (_rawVideo || (_oc->oformat->flags & AVFMT_RAWPICTURE))
+      writeRawPicture(image, arrival);
+   else {
+      // the monitor keeps a copy, the encoder may be given the filter frame itself
+      if (_quality && _quality->sampled(_frameCount)) {
+         Allocations::Scope pause(false);
+         _quality->addSource(_frameCount, _frame->pts, _frame->data, _frame->linesize);
+      }
+      _arrivals.push_back(arrival);
+      uint8_t *buffer = acquirePacket(pkt);
+      
+      int got_output;
+      int ret;
+      {
+         PerfStats::Scope scope(_perf.get(), PERF_ENCODE);
+         TraceSpan span("encode", image->pts);
+         ret = avcodec_encode_video2(c, &pkt, _frame.get(), &got_output);
+      }
+      if (ret < 0) {
+         releasePacket(pkt, buffer);
+         throw std::runtime_error("Error encoding video frame");
+      }
+      
+      _encodeSeconds += std::chrono::duration<double>(Clock::now() - encodeStart).count();
+      _encodedFrames++;
+
+      // If size is zero, it means the image was buffered.
+      if (got_output) {
+         if (c->coded_frame->key_frame)
+            pkt.flags |= AV_PKT_FLAG_KEY;
+         pkt.stream_index = _videoSt->index;
+         if (_quality) {
+            Allocations::Scope pause(false);
+            _quality->addPacket(pkt);
+         }
+         try {
+            writePacket(pkt);
+         }
+         catch (...) {
+            releasePacket(pkt, buffer);
+            throw;
+         }
+         // low delay encoders output the packet of the frame they were given
+         if (image->inputTime != Clock::time_point())
+            _muxLatency.add(image->inputTime);
+      }
+      holdPacket(pkt, buffer, got_output && _intraOnly && _arrivals.empty());
+   }
+   _frame->pts += av_rescale_q(1, c->time_base, _videoSt->time_base);
+   _frameCount++;
+}
+
+// The size of a width x height picture stored without padding from data[0]
+// on, or 0 when the planes of data are not laid out that way.
+static int packedSize(uint8_t *const data[4], const int linesizes[4], enum AVPixelFormat pixFmt,
+                      int width, int height)
+{
+   uint8_t *packed[4];
+   int packedLinesizes[4];
+   if (av_image_fill_linesizes(packedLinesizes, pixFmt, width) < 0)
+      return 0;
+   int size = av_image_fill_pointers(packed, pixFmt, height, data[0], packedLinesizes);
+   if (size < 0)
+      return 0;
+   for (int i(0); i < 4; ++i)
+      if (packed[i] && (packed[i] != data[i] || packedLinesizes[i] != linesizes[i]))
+         return 0;
+   return size;
+}
+
+void Muxer::writeRawPicture(const Image& image, Clock::time_point arrival)
+{
+   AVCodecContext *c = _encCtx;
+   AVPacket pkt;
+   av_init_packet(&pkt);
+   AVPicture picture;
+   if (_oc->oformat->flags & AVFMT_RAWPICTURE) {
+      // these muxers take the AVPicture itself and read the planes through it
+      for (int i(0); i < 4; ++i) {
+         picture.data[i] = _frame->data[i];
+         picture.linesize[i] = _frame->linesize[i];
+      }
+      pkt.data = (uint8_t*)&picture;
+      pkt.size = sizeof(AVPicture);
+   }
+   else {
+      // The packet points at the picture: the converted one, or the filter
+      // frame when it already has the output format and size. Only frame
+      // lines with padding are copied together first.
+      pkt.size = packedSize(_frame->data, _frame->linesize, c->pix_fmt, c->width, c->height);
+      if (!pkt.size) {
+         TraceSpan span("copy", image->pts);
+         av_image_copy(_dstPicture.data, _dstPicture.linesize, (const uint8_t **)_frame->data,
+                       _frame->linesize, c->pix_fmt, c->width, c->height);
+         pkt.size = avpicture_get_size(c->pix_fmt, c->width, c->height);
+         pkt.data = _dstPicture.data[0];
+      }
+      else
+         pkt.data = _frame->data[0];
+   }
+   pkt.flags |= AV_PKT_FLAG_KEY;
+   pkt.stream_index = _videoSt->index;
+   pkt.pts = pkt.dts = _frame->pts;
+   // av_write_frame writes a single stream straight from the picture,
+   // interleaving with audio copies it
+   _arrivals.push_back(arrival);
+   writePacket(pkt);
+   if (image->inputTime != Clock::time_point())
+      _muxLatency.add(image->inputTime);
+   _encodedFrames++;
+}
+
+void Muxer::writePacket(AVPacket& pkt)
+{
+   PerfStats::Scope scope(_perf.get(), PERF_MUX);
+   TraceSpan span("write", pkt.pts);
+   // With a single stream there is nothing to interleave: av_write_frame hands
+   // the packet straight to the muxer, whereas av_interleaved_write_frame
+   // would duplicate a pool buffer into a freshly allocated packet.
+   int ret;
+   {
+      IoInterrupt::Operation operation(_interrupt);
+      ret = _oc->nb_streams == 1 ? av_write_frame(_oc.get(), &pkt)
+                                 : av_interleaved_write_frame(_oc.get(), &pkt);
+   }
+   if (ret < 0) {
+      _interrupt.check("writing video");
+      throw std::runtime_error("Error while writing video frame");
+   }
+   if (_firstDts[_videoSt->index] == AV_NOPTS_VALUE)
+      _firstDts[_videoSt->index] = pkt.dts;
+
+   // packets leave the encoder in frame order
+   if (!_arrivals.empty()) {
+      _unflushed.push_back(_arrivals.front());
+      _arrivals.pop_front();
+   }
+   if (_config.fragmentDuration > 0)
+      trackFragments();
+}
+
+void Muxer::writeAudioPackets(const PacketRefs& packets)
+{
+   for (auto packet(packets.begin()); packet != packets.end(); ++packet) {
+      const AVPacket& src = **packet;
+      auto track = std::find_if(_audioTracks.begin(), _audioTracks.end(),
+                                [&](const AudioTrack& track) { return track.input == src.stream_index; });
+      if (track == _audioTracks.end())
+         continue;
+      int64_t resumeDts = _resumeDts[track->stream->index];
+      if (resumeDts != AV_NOPTS_VALUE && src.dts != AV_NOPTS_VALUE
+          && av_rescale_q(src.dts, track->timeBase, track->stream->time_base) <= resumeDts)
+         // in the output before the checkpoint
+         continue;
+      if (_checkpointFrames)
+         _heldAudio.push_back(*packet);
+      else
+         writeAudioPacket(src, *track);
+   }
+}
+
+void Muxer::writeAudioPacket(const AVPacket& src, const AudioTrack& track)
+{
+   // borrows the payload: av_interleaved_write_frame duplicates a packet
+   // it doesn't own before queueing it, the shared one stays untouched
+   AVPacket pkt = src;
+   pkt.destruct = NULL;
+   pkt.side_data = NULL;
+   pkt.side_data_elems = 0;
+   pkt.stream_index = track.stream->index;
+   AVRational timeBase = track.stream->time_base;
+   if (src.pts != AV_NOPTS_VALUE)
+      pkt.pts = av_rescale_q(src.pts, track.timeBase, timeBase);
+   if (src.dts != AV_NOPTS_VALUE)
+      pkt.dts = av_rescale_q(src.dts, track.timeBase, timeBase);
+   pkt.duration = av_rescale_q(src.duration, track.timeBase, timeBase);
+
+   PerfStats::Scope scope(_perf.get(), PERF_MUX);
+   TraceSpan span("write audio", pkt.pts);
+   IoInterrupt::Operation operation(_interrupt);
+   if (av_interleaved_write_frame(_oc.get(), &pkt) < 0) {
+      _interrupt.check("writing audio");
+      throw std::runtime_error("Error while writing audio packet");
+   }
+   if (_firstDts[pkt.stream_index] == AV_NOPTS_VALUE)
+      _firstDts[pkt.stream_index] = pkt.dts;
+}
+
+// With checkpoints the audio reaches the interleaver along with the video
+// frame of its time, not as it is read: what a checkpoint flushes then
+// depends on the frames before it only, not on how far the input was read,
+// and a resumed job writes the same. until is a video stream pts, or
+// AV_NOPTS_VALUE for everything.
+void Muxer::writeHeldAudio(int64_t until)
+{
+   PacketRefs later;
+   for (auto packet(_heldAudio.begin()); packet != _heldAudio.end(); ++packet) {
+      const AVPacket& src = **packet;
+      auto track = std::find_if(_audioTracks.begin(), _audioTracks.end(),
+                                [&](const AudioTrack& track) { return track.input == src.stream_index; });
+      if (until == AV_NOPTS_VALUE || src.dts == AV_NOPTS_VALUE
+          || av_compare_ts(src.dts, track->timeBase, until, _videoSt->time_base) <= 0)
+         writeAudioPacket(src, *track);
+      else
+         later.push_back(*packet);
+   }
+   _heldAudio.swap(later);
+}
+
+void Muxer::repeatPacket(Clock::time_point arrival)
+{
+   // a copy that doesn't own the payload, the held packet keeps it
+   AVPacket pkt = _lastPacket;
+   pkt.destruct = NULL;
+   pkt.pts = pkt.dts = _frame->pts;
+   _arrivals.push_back(arrival);
+   writePacket(pkt);
+   _repeatedFrames++;
+}
+
+void Muxer::holdPacket(AVPacket& pkt, uint8_t *poolBuffer, bool repeatable)
+{
+   releasePacket(_lastPacket, _lastBuffer);
+   _lastBuffer = NULL;
+   // av_interleaved_write_frame takes over the payload the encoder allocated
+   // rather than copying it: then it is not ours to repeat
+   if (repeatable && (poolBuffer || pkt.destruct)) {
+      _lastPacket = pkt;
+      _lastBuffer = poolBuffer;
+   }
+   else
+      releasePacket(pkt, poolBuffer);
+}
+
+// An empty packet for the encoder: a pool buffer, returned, or none for the
+// encoder to allocate.
+uint8_t *Muxer::acquirePacket(AVPacket& pkt)
+{
+   if (_pooledPackets)
+      return _packetPool.acquire(pkt);
+   av_init_packet(&pkt);
+   pkt.data = NULL;
+   pkt.size = 0;
+   return NULL;
+}
+
+// Gives poolBuffer back, or frees what the encoder allocated for pkt.
+void Muxer::releasePacket(AVPacket& pkt, uint8_t *poolBuffer)
+{
+   _packetPool.release(poolBuffer);
+   av_free_packet(&pkt);
+}
+
+void Muxer::enablePerfCounters()
+{
+   _perf.reset(new PerfStats({"convert", "encode", "mux"}));
+}
+
+int64_t Muxer::convertMissBytes() const
+{
+   int64_t misses = _perf ? _perf->total(PERF_CONVERT, PerfStats::LLC_MISSES) : -1;
+   if (misses < 0)
+      return -1;
+   long line = sysconf(_SC_LEVEL3_CACHE_LINESIZE);
+   return misses * (line > 0 ? line : 64);
+}
+
+double Muxer::savedEncodeSeconds() const
+{
+   return _encodedFrames ? _repeatedFrames * (_convertSeconds + _encodeSeconds) / _encodedFrames : 0.;
+}
+
+void Muxer::trackFragments()
+{
+   Clock::time_point now = Clock::now();
+   if (avio_tell(_oc->pb) != _flushedPos) {
+      // The mov muxer closes a fragment when the next packet would exceed
+      // frag_duration, so the fragment just emitted holds every written
+      // frame except the newest one.
+      avio_flush(_oc->pb);
+      _flushedPos = avio_tell(_oc->pb);
+      while (_unflushed.size() > 1) {
+         _diskLatency.add(_unflushed.front(), now);
+         _unflushed.pop_front();
+      }
+   }
+   if (_config.flushInterval > 0 && !_unflushed.empty()
+       && now - _unflushed.front() >= std::chrono::milliseconds(_config.flushInterval))
+      flushFragment();
+}
+
+void Muxer::flushFragment()
+{
+   // a NULL packet makes the mov muxer write out the open fragment
+   IoInterrupt::Operation operation(_interrupt);
+   if (av_write_frame(_oc.get(), NULL) < 0) {
+      _interrupt.check("flushing a fragment");
+      throw std::runtime_error("Could not flush the output fragment");
+   }
+   avio_flush(_oc->pb);
+   _flushedPos = avio_tell(_oc->pb);
+
+   Clock::time_point now = Clock::now();
+   for (auto arrival(_unflushed.begin()); arrival != _unflushed.end(); ++arrival)
+      _diskLatency.add(*arrival, now);
+   _unflushed.clear();
+}
+
+// Writes the frames an encoder with delay still holds.
+void Muxer::drainEncoder()
+{
+   AVCodecContext *c = _encCtx;
+   if (!(c->codec->capabilities & CODEC_CAP_DELAY) && !(c->active_thread_type & FF_THREAD_FRAME))
+      return;
+   for (;;) {
+      AVPacket pkt;
+      uint8_t *buffer = acquirePacket(pkt);
+      int got_output(0);
+      if (avcodec_encode_video2(c, &pkt, NULL, &got_output) < 0) {
+         releasePacket(pkt, buffer);
+         throw std::runtime_error("Error draining the encoder");
+      }
+      if (!got_output) {
+         // pkt.data is NULL by now
+         releasePacket(pkt, buffer);
+         break;
+      }
+      if (c->coded_frame->key_frame)
+         pkt.flags |= AV_PKT_FLAG_KEY;
+      pkt.stream_index = _videoSt->index;
+      if (_quality)
+         _quality->addPacket(pkt);
+      try {
+         writePacket(pkt);
+      }
+      catch (...) {
+         releasePacket(pkt, buffer);
+         throw;
+      }
+      releasePacket(pkt, buffer);
+   }
+}
+
+void Muxer::reopenEncoder()
+{
+   drainEncoder();
+   AVCodecContext *c = _encCtx;
+   avcodec_close(c);
+   AVDictionary *options = encoderOptions();
+   int ret = avcodec_open2(c, _videoCodec, &options);
+   av_dict_free(&options);
+   if (ret < 0)
+      throw std::runtime_error("Could not reopen video codec");
+}
+
+void Muxer::checkpoint(const Image& image)
+{
+   // The frames still in the encoder belong before the checkpoint. Rate
+   // control, references and frame threads start over after it, as they do
+   // in a job resumed there.
+   if (!_rawVideo && (!_intraOnly || (_encCtx->codec->capabilities & CODEC_CAP_DELAY)
+                      || (_encCtx->active_thread_type & FF_THREAD_FRAME)))
+      reopenEncoder();
+   // a resumed job has no packet to repeat either
+   releasePacket(_lastPacket, _lastBuffer);
+   _lastBuffer = NULL;
+   if (_oc->nb_streams > 1) {
+      // what the interleaver holds back goes into this fragment
+      IoInterrupt::Operation operation(_interrupt);
+      if (av_interleaved_write_frame(_oc.get(), NULL) < 0) {
+         _interrupt.check("writing the output");
+         throw std::runtime_error("Could not flush the interleaved packets");
+      }
+   }
+   flushFragment();
+
+   Checkpoint checkpoint;
+   checkpoint.offset = _flushedPos;
+   checkpoint.frames = _frameCount + _droppedFrames;
+   checkpoint.nextPts = _frame->pts;
+   checkpoint.filterPts = image->pts;
+   checkpoint.inputFrame = image->resumeFrame;
+   checkpoint.inputPts = image->resumePts;
+   checkpoint.firstDts = _firstDts;
+   TraceSpan span("checkpoint", image->pts);
+   checkpoint.save(_config.checkpoint);
+}
+
+// The muxer context only lives in memory: it is rebuilt by writing the
+// packets of the output up to the checkpoint again, in the order they are in
+// the file and with the same fragments, into a sink that checks them against
+// the file. Then the file is truncated at the checkpoint and written on.
+void Muxer::resumeOutput()
+{
+   const Checkpoint& checkpoint = *_config.resume;
+   const AVFormatContext *input = _replay->input();
+   if (input->nb_streams != _oc->nb_streams || checkpoint.firstDts.size() != _oc->nb_streams)
+      throw std::runtime_error(std::string(_filename) + " does not have the streams of this output");
+   // the demuxer starts the tracks at its own timestamps
+   std::vector<int64_t> shift(_oc->nb_streams, AV_NOPTS_VALUE);
+   Packet packet;
+   bool fragment;
+   while (_replay->read(packet, fragment)) {
+      int index = packet->stream_index;
+      AVRational inputBase = input->streams[index]->time_base;
+      AVRational timeBase = _oc->streams[index]->time_base;
+      if (packet->pts != AV_NOPTS_VALUE)
+         packet->pts = av_rescale_q(packet->pts, inputBase, timeBase);
+      if (packet->dts != AV_NOPTS_VALUE)
+         packet->dts = av_rescale_q(packet->dts, inputBase, timeBase);
+      packet->duration = av_rescale_q(packet->duration, inputBase, timeBase);
+      if (shift[index] == AV_NOPTS_VALUE)
+         shift[index] = checkpoint.firstDts[index] != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE
+                      ? checkpoint.firstDts[index] - packet->dts : 0;
+      if (packet->pts != AV_NOPTS_VALUE)
+         packet->pts += shift[index];
+      if (packet->dts != AV_NOPTS_VALUE)
+         packet->dts += shift[index];
+
+      if (fragment && av_write_frame(_oc.get(), NULL) < 0)
+         throw std::runtime_error("Could not replay a fragment of " + std::string(_filename));
+      if (av_write_frame(_oc.get(), packet.get()) < 0)
+         throw std::runtime_error("Could not replay a packet of " + std::string(_filename));
+      _resumeDts[index] = packet->dts;
+   }
+   // the fragment the checkpoint closed
+   if (av_write_frame(_oc.get(), NULL) < 0)
+      throw std::runtime_error("Could not replay a fragment of " + std::string(_filename));
+   _replay->verify();
+
+   // what follows the checkpoint is lost work
+   _oc->pb = NULL;
+   _oc->flags &= ~AVFMT_FLAG_CUSTOM_IO;
+   _replay.reset();
+   if (truncate(_filename, checkpoint.offset) < 0)
+      throw std::runtime_error(std::string("Could not truncate ") + _filename + ": " + strerror(errno));
+   int ret;
+   {
+      IoInterrupt::Operation operation(_interrupt);
+      // read-write: opened for writing only, the file would be truncated
+      ret = avio_open2(&_oc->pb, _filename, AVIO_FLAG_READ_WRITE, &_oc->interrupt_callback, NULL);
+   }
+   if (ret < 0) {
+      _interrupt.check("opening the output");
+      throw std::runtime_error("Could not open file");
+   }
+   if (avio_seek(_oc->pb, checkpoint.offset, SEEK_SET) != checkpoint.offset)
+      throw std::runtime_error(std::string("Could not seek to the checkpoint of ") + _filename);
+   _flushedPos = checkpoint.offset;
+   _frameCount = checkpoint.frames;
+   _frame->pts = checkpoint.nextPts;
+   _resumePts = checkpoint.filterPts;
+   _firstDts = checkpoint.firstDts;
+}
+
+// Add an output stream.
+AVStream* Muxer::addStream(enum AVCodecID codec_id)
+{
+   AVCodecContext *c;
+   AVStream *st;
+
+   // find the encoder
+   _videoCodec = avcodec_find_encoder(codec_id);
+   if (!(_videoCodec))
+      throw std::runtime_error("Could not find encoder");
+
+   st = avformat_new_stream(_oc.get(), _videoCodec);
+   if (!st)
+      throw std::runtime_error("Could not allocate stream");
+
+   st->id = _oc->nb_streams-1;
+   c = st->codec;
+
+   switch ((_videoCodec)->type) {
+      case AVMEDIA_TYPE_AUDIO:
+         st->id = 1;
+         c->sample_fmt  = AV_SAMPLE_FMT_S16;
+         c->bit_rate    = 64000;
+         c->sample_rate = 44100;
+         c->channels    = 2;
+      break;
+
+      case AVMEDIA_TYPE_VIDEO:
+         c->codec_id = codec_id;
+
+         c->bit_rate = _config.bitRate;
+         // Resolution must be a multiple of two.
+         c->width    = _config.width;
+         c->height   = _config.height;
+         /* timebase: This is the fundamental unit of time (in seconds) in terms
+         * of which frame timestamps are represented. For fixed-fps content,
+         * timebase should be 1/framerate and timestamp increments should be
+         * identical to 1. */
+         c->time_base     = av_inv_q(_config.frameRate);
+         c->gop_size      = 12; // emit one intra frame every twelve frames at most
+         if (_config.lowDelay) {
+            c->max_b_frames = 0;
+            c->flags |= CODEC_FLAG_LOW_DELAY;
+            c->thread_type = FF_THREAD_SLICE;
+         }
+         c->pix_fmt       = _config.pixFmt;
+         if (_videoCodec->pix_fmts) {
+            // fall back to the encoder's preferred format when it can't take the configured one
+            const enum AVPixelFormat *fmt = _videoCodec->pix_fmts;
+            while (*fmt != AV_PIX_FMT_NONE && *fmt != _config.pixFmt)
+               ++fmt;
+            if (*fmt == AV_PIX_FMT_NONE)
+               c->pix_fmt = _videoCodec->pix_fmts[0];
+         }
+         if (c->codec_id == AV_CODEC_ID_MPEG2VIDEO && !_config.lowDelay) {
+            // just for testing, we also add B frames
+            c->max_b_frames = 2;
+         }
+         if (c->codec_id == AV_CODEC_ID_MPEG1VIDEO) {
+            /* Needed to avoid using macroblocks in which some coeffs overflow.
+             * This does not happen with normal video, it just happens here as
+             * the motion of the chroma plane does not match the luma plane. */
+            c->mb_decision = 2;
+         }
+      break;
+
+      default:
+      break;
+   }
+
+   // Some formats want stream headers to be separate.
+   if (_oc->oformat->flags & AVFMT_GLOBALHEADER)
+      c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+   return st;
+}
+
+// Add an output stream with the parameters of an input stream, for packets
+// copied without decoding.
+void Muxer::addAudioStream(const AVStream *input)
+{
+   AVStream *st = avformat_new_stream(_oc.get(), NULL);
+   if (!st)
+      throw std::runtime_error("Could not allocate stream");
+   st->id = _oc->nb_streams-1;
+   if (avcodec_copy_context(st->codec, input->codec) < 0)
+      throw std::runtime_error("Could not copy audio stream parameters");
+   // the input container's tag may mean something else in ours, let the muxer pick
+   st->codec->codec_tag = 0;
+   st->time_base = input->time_base;
+   av_dict_copy(&st->metadata, input->metadata, 0);
+   if (_oc->oformat->flags & AVFMT_GLOBALHEADER)
+      st->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+   _audioTracks.push_back({input->index, input->time_base, st});
+}
@@ -0,0 +1,247 @@
+#ifndef MUXER_HPP
+#define MUXER_HPP
+
+#include "allocations.h"
+#include "avptr.h"
+#include "bandpass.h"
+#include "cancel.h"
+#include "checkpoint.h"
+#include "checksum.h"
+#include "encoderpool.h"
+#include "image.h"
+#include "latency.h"
+#include "packetpool.h"
+#include "perfcounters.h"
+#include "qualitymonitor.h"
+#include "streamio.h"
+#include "trace.h"
+
+#include "libav.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Output rendition settings, the defaults are the DNxHD master.
+struct MuxerConfig
+{
+   const char *format = "mov";
+   // AV_CODEC_ID_RAWVIDEO writes uncompressed pictures without an encoder,
+   // with pixFmt a packed format the container knows, e.g. UYVY422 in mov
+   enum AVCodecID codec = AV_CODEC_ID_DNXHD;
+   enum AVPixelFormat pixFmt = AV_PIX_FMT_YUV422P;
+   int width = 1920;
+   int height = 1080;
+   int bitRate = 120000000;
+   // Rate of the frames handed to the muxer, the filter output rate.
+   AVRational frameRate = {25, 1};
+   // Fragmented mov: an empty moov up front, then self-contained fragments of
+   // at most this many ms that are readable as soon as they hit the disk.
+   // 0 writes a classic mov, unreadable until it is closed. Stream outputs
+   // (see StreamIO) can't seek back to write the moov and are always fragmented.
+   int fragmentDuration = 0;
+   // Fragmented output only: close the current fragment once a frame has
+   // waited this many ms for its bytes to reach the disk, 0 to never force it.
+   int flushInterval = 0;
+   // Live output: no B-frames, lookahead or frame threads in the encoder.
+   bool lowDelay = false;
+   // Drop frames that waited more than this many ms since they were read
+   // from the input instead of encoding them, 0 encodes every frame.
+   int dropLate = 0;
+   // Encoder input pictures from this allocator instead of av_malloc.
+   std::shared_ptr<FrameAllocator> allocator;
+   // Opened encoders come from and, when reusable, go back to this pool.
+   std::shared_ptr<EncoderPool> encoders;
+   // Input streams copied into the output as they are, after the video
+   // stream. Their packets come from writeAudioPackets, on the timeline of
+   // the frames; the streams only need to live through the constructor.
+   std::vector<AVStream*> audioStreams;
+   // Per-frame checksums of the pictures as the encoder gets them, in the
+   // codec format and size, to this sidecar; see ChecksumWriter.
+   std::string checksums;
+   // PSNR and SSIM of sampled frames of the encoder output, see QualityMonitor.
+   QualityConfig quality;
+   // Cancels encoding and writing; the write calls throw Cancelled and
+   // closing on cancel doesn't wait on the output.
+   std::shared_ptr<CancelToken> cancel;
+   // ms any one open or write may block, 0 for no limit
+   int ioTimeout = 0;
+   // Save a Checkpoint to this file every checkpointInterval ms of output,
+   // 0 for none. A checkpoint closes the fragment and drains the encoder,
+   // and opens it again unless it is intra-only without delay, so the
+   // output after it doesn't depend on what came before. Fragmented file
+   // output only; the file is removed once the output is complete.
+   int checkpointInterval = 0;
+   std::string checkpoint;
+   // Take up the output at this checkpoint instead of starting it: the
+   // output is read back and truncated there, then frames up to its filter
+   // pts and audio written before it are skipped. The result is the output
+   // of a run that was never interrupted, see Filter::resumeFrom for the
+   // frames.
+   std::shared_ptr<const Checkpoint> resume;
+};
+
+class Muxer
+{
+public:
+   Muxer(const char *dst, const MuxerConfig& config = MuxerConfig());
+   virtual ~Muxer();
+   void writeVideoFrames(const Images& images);
+   void writeVideoFrame(const Image& image);
+   // Packets of the configured audio streams, interleaved with the video by
+   // timestamp. Packets of other streams are ignored.
+   void writeAudioPackets(const PacketRefs& packets);
+   // Writes what the encoder still holds, the held audio and the trailer.
+   // Once: later calls and the destructor do nothing.
+   void close();
+   int packetAllocations() const { return _packetPool.allocations(); }
+   // Per-pixel processing fused into the colorspace conversion, see BandPass.
+   void addPixelStage(const BandPass::Stage& stage) { _pixelStages.push_back(stage); }
+   // Working set of one conversion band, 0 converts whole frames.
+   void setBandBytes(int bytes) { _bandBytes = bytes; }
+   const BandPass *bandPass() const { return _bandPass.get(); }
+   // time from a frame entering writeVideoFrame to its bytes being on disk,
+   // measured for fragmented output
+   const LatencyStats& diskLatency() const { return _diskLatency; }
+   // time from reading a frame's input packet to muxing its encoded packet
+   const LatencyStats& muxLatency() const { return _muxLatency; }
+   int droppedFrames() const { return _droppedFrames; }
+   // time spent converting frames to the codec format and size, and encoding them
+   double convertSeconds() const { return _convertSeconds; }
+   double encodeSeconds() const { return _encodeSeconds; }
+   int encodedFrames() const { return _encodedFrames; }
+   // frames flagged as duplicates that repeated the previous packet, and the
+   // conversion and encode time they would have cost on average
+   int repeatedFrames() const { return _repeatedFrames; }
+   double savedEncodeSeconds() const;
+   // Hardware counters for the convert, encode and mux stages, opened on
+   // the thread that writes the frames.
+   void enablePerfCounters();
+   const PerfStats *perfStats() const { return _perf.get(); }
+   // main memory bytes the conversion read and wrote, from its LLC misses;
+   // -1 without the counters
+   int64_t convertMissBytes() const;
+   // Counts the heap allocations of encoding and writing each frame once the
+   // first ALLOCATION_WARMUP_FRAMES are through. Quality monitor copies
+   // are not counted; the audio interleaver's copy of every packet and the
+   // packets of encoders outside the pool are.
+   void enableAllocationCount() { _countAllocations = true; }
+   int64_t steadyAllocations() const { return _steadyAllocations; }
+   int64_t steadyFrames() const { return _steadyFrames; }
+   int64_t bytesWritten() const;
+   // with MuxerConfig::quality, nullptr otherwise
+   QualityMonitor *quality() { return _quality.get(); }
+
+private:
+   // a stream copied from the input, by input stream index
+   struct AudioTrack
+   {
+      int input;
+      AVRational timeBase;
+      AVStream *stream;
+   };
+
+   void init();
+   void openVideo();
+   AVDictionary *encoderOptions() const;
+   void encodeVideoFrame(const Image& image);
+   void writeAudioPacket(const AVPacket& src, const AudioTrack& track);
+   void writeHeldAudio(int64_t until);
+   void drainEncoder();
+   void reopenEncoder();
+   void checkpoint(const Image& image);
+   void resumeOutput();
+   AVStream *addStream(enum AVCodecID codec_id);
+   void addAudioStream(const AVStream *input);
+   void writePacket(AVPacket& pkt);
+   void writeRawPicture(const Image& image, Clock::time_point arrival);
+   void repeatPacket(Clock::time_point arrival);
+   void holdPacket(AVPacket& pkt, uint8_t *poolBuffer, bool repeatable);
+   uint8_t *acquirePacket(AVPacket& pkt);
+   void releasePacket(AVPacket& pkt, uint8_t *poolBuffer);
+   void trackFragments();
+   void flushFragment();
+
+   const char *_filename;
+   MuxerConfig _config;
+   const enum AVPixelFormat SRC_STREAM_PIX_FMT = AV_PIX_FMT_RGB444;
+   const int _sws_flags = SWS_BICUBIC;
+   const int PACKET_POOL_SIZE = 4;
+   const int STREAM_FRAGMENT_DURATION = 1000;
+   const int ALLOCATION_WARMUP_FRAMES = 50;
+
+   // released in reverse order: the encoder before the context that owns
+   // its codec context, the context before the stream output it writes to
+   IoInterrupt _interrupt;
+   std::unique_ptr<StreamIO> _output;
+   // the output until a resumed one is verified
+   std::unique_ptr<OutputReplay> _replay;
+   AVOutputFormat *_fmt = nullptr;
+   OutputFormatPtr _oc;
+   AVCodec *_videoCodec = nullptr;
+   OpenCodecPtr _encoder;
+   // or an encoder context of our own, from and back to the encoder pool
+   CodecContextPtr _pooledEncoder;
+   EncoderKey _encoderKey;
+   // whichever of the two encodes
+   AVCodecContext *_encCtx = nullptr;
+   FramePtr _frame;
+   AVStream *_videoSt = nullptr;
+   std::vector<AudioTrack> _audioTracks;
+   // _dstPicture planes live in _dstBuffer, from av_malloc or the allocator
+   typedef std::unique_ptr<uint8_t, std::function<void(uint8_t*)>> PictureBuffer;
+   AVPicture _dstPicture;
+   PictureBuffer _dstBuffer;
+   std::unique_ptr<BandPass> _bandPass;
+   std::vector<BandPass::Stage> _pixelStages;
+   int _bandBytes = BandPass::CACHE_BYTES;
+   PacketPool _packetPool;
+   // the packet of the last encoded frame while it can stand for a duplicate
+   // of that frame: intra-only codec and no frames pending in the encoder
+   AVPacket _lastPacket;
+   // its pool buffer, NULL when there is none or the encoder allocated it
+   uint8_t *_lastBuffer = nullptr;
+   // DNxHD: encoded packets go into _packetPool
+   bool _pooledPackets = false;
+   bool _intraOnly = false;
+   // rawvideo: packets are the pictures themselves, there is no encoder
+   bool _rawVideo = false;
+
+   // frames handed to the encoder, then frames written whose bytes may still
+   // sit in the open fragment, oldest first
+   std::deque<Clock::time_point> _arrivals;
+   std::deque<Clock::time_point> _unflushed;
+   int64_t _flushedPos = 0;
+   LatencyStats _diskLatency;
+   LatencyStats _muxLatency;
+   int _droppedFrames = 0;
+   int _repeatedFrames = 0;
+   int _encodedFrames = 0;
+   bool _closed = false;
+   bool _countAllocations = false;
+   int64_t _steadyAllocations = 0;
+   int64_t _steadyFrames = 0;
+   std::unique_ptr<PerfStats> _perf;
+   std::unique_ptr<ChecksumWriter> _checksums;
+   std::unique_ptr<QualityMonitor> _quality;
+   enum { PERF_CONVERT, PERF_ENCODE, PERF_MUX };
+   double _convertSeconds = 0.;
+   double _encodeSeconds = 0.;
+
+   double _videoPts = 0.0;
+   int _frameCount = 0;
+
+   // frame slots from one checkpoint to the next, 0 for none
+   int _checkpointFrames = 0;
+   // by output stream: the dts of the first packet, and of the last one
+   // already in a resumed output
+   std::vector<int64_t> _firstDts;
+   std::vector<int64_t> _resumeDts;
+   // filter pts of the last frame already in a resumed output
+   int64_t _resumePts = AV_NOPTS_VALUE;
+   // with checkpoints, the audio the video has not reached yet
+   PacketRefs _heldAudio;
+};
+
+#endif // MUXER_HPP
@@ -0,0 +1,53 @@
+#include "packetpool.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+PacketPool::~PacketPool()
+{
+   for (auto buffer(_buffers.begin()); buffer != _buffers.end(); ++buffer)
+      av_free(*buffer);
+}
+
+void PacketPool::reserve(int bufferSize, int count)
+{
+   if (!_buffers.empty())
+      throw std::runtime_error("Packet pool already reserved");
+
+   _bufferSize = std::max(bufferSize, FF_MIN_BUFFER_SIZE);
+   for (int i(0); i < count; ++i)
+      _free.push_back(allocate());
+   // allocations made up front are not counted against steady state
+   _allocations = 0;
+}
+
+uint8_t *PacketPool::allocate()
+{
+   // the padding is required by the bitstream readers and writers
+   uint8_t *buffer = static_cast<uint8_t*>(av_malloc(_bufferSize + FF_INPUT_BUFFER_PADDING_SIZE));
+   if (!buffer)
+      throw std::runtime_error("Could not allocate packet buffer");
+   memset(buffer + _bufferSize, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+   _buffers.push_back(buffer);
+   ++_allocations;
+   return buffer;
+}
+
+uint8_t *PacketPool::acquire(AVPacket& pkt)
+{
+   av_init_packet(&pkt);
+   if (_free.empty())
+      // the pool grows rather than fails; allocations() reports it
+      _free.push_back(allocate());
+   pkt.data = _free.back();
+   pkt.size = _bufferSize;
+   _free.pop_back();
+   return pkt.data;
+}
+
+void PacketPool::release(uint8_t *buffer)
+{
+   if (buffer)
+      _free.push_back(buffer);
+}
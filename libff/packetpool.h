@@ -0,0 +1,35 @@
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include "libav.h"
+
+#include <vector>
+
+// Fixed set of preallocated packet payload buffers handed to the encoder
+// so that steady-state encoding does not go through the packet allocator.
+class PacketPool
+{
+public:
+   PacketPool() {}
+   ~PacketPool();
+   void reserve(int bufferSize, int count);
+   // Points pkt at a free buffer and returns it. The caller gives that
+   // pointer back rather than pkt.data: an encoder that outputs nothing
+   // clears pkt.data.
+   uint8_t *acquire(AVPacket& pkt);
+   void release(uint8_t *buffer);
+   int bufferSize() const { return _bufferSize; }
+   int allocations() const { return _allocations; }
+
+private:
+   PacketPool(const PacketPool&);
+   PacketPool& operator=(const PacketPool&);
+   uint8_t *allocate();
+
+   std::vector<uint8_t*> _buffers;
+   std::vector<uint8_t*> _free;
+   int _bufferSize = 0;
+   int _allocations = 0;
+};
+
+#endif // PACKETPOOL_H
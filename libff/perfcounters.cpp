@@ -0,0 +1,136 @@
+#include "perfcounters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const uint64_t COUNTER_CONFIGS[PerfStats::COUNTERS] = {
+   PERF_COUNT_HW_CPU_CYCLES,
+   PERF_COUNT_HW_INSTRUCTIONS,
+   PERF_COUNT_HW_CACHE_MISSES,     // last level cache on every PMU we run on
+   PERF_COUNT_HW_BRANCH_MISSES
+};
+
+PerfStats::Scope::Scope(PerfStats *stats, int stage)
+: _stats(stats && stats->counting() ? stats : nullptr)
+, _stage(stage)
+{
+   if (_stats)
+      _stats->read(_start);
+}
+
+PerfStats::Scope::~Scope()
+{
+   if (!_stats)
+      return;
+   uint64_t end[COUNTERS];
+   _stats->read(end);
+   std::vector<uint64_t>& totals = _stats->_totals[_stage];
+   for (int counter(0); counter < COUNTERS; ++counter)
+      totals[counter] += end[counter] - _start[counter];
+   ++_stats->_samples[_stage];
+}
+
+PerfStats::PerfStats(const std::vector<std::string>& stages)
+: _names(stages)
+, _totals(stages.size(), std::vector<uint64_t>(COUNTERS))
+, _samples(stages.size())
+{
+   for (int counter(0); counter < COUNTERS; ++counter) {
+      _fds[counter] = -1;
+      _slots[counter] = -1;
+   }
+}
+
+PerfStats::~PerfStats()
+{
+   for (int counter(0); counter < COUNTERS; ++counter)
+      if (_fds[counter] >= 0)
+         close(_fds[counter]);
+}
+
+bool PerfStats::open()
+{
+   _opened = true;
+   _thread = std::this_thread::get_id();
+   // one group, so all counters cover the same instructions
+   for (int counter(0); counter < COUNTERS; ++counter) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = COUNTER_CONFIGS[counter];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int fd = syscall(SYS_perf_event_open, &attr, 0, -1, _leader, 0);
+      if (fd < 0) {
+         if (_leader < 0) {
+            // without cycles there is nothing to report
+            _error = strerror(errno);
+            return false;
+         }
+         // e.g. no generic cache event on this PMU: report the others
+         continue;
+      }
+      if (_leader < 0)
+         _leader = fd;
+      _fds[counter] = fd;
+      _slots[counter] = _members++;
+   }
+   return true;
+}
+
+void PerfStats::read(uint64_t values[COUNTERS]) const
+{
+   struct
+   {
+      uint64_t nr;
+      uint64_t timeEnabled;
+      uint64_t timeRunning;
+      uint64_t values[COUNTERS];
+   } group;
+   memset(&group, 0, sizeof(group));
+   if (::read(_leader, &group, sizeof(group)) < 0)
+      group.timeRunning = 0;
+   // the kernel multiplexes groups when the PMU is shared: scale up
+   double scale = group.timeRunning ? (double)group.timeEnabled / group.timeRunning : 0.;
+   for (int counter(0); counter < COUNTERS; ++counter)
+      values[counter] = _slots[counter] >= 0 ? (uint64_t)(group.values[_slots[counter]] * scale) : 0;
+}
+
+int64_t PerfStats::total(int stage, Counter counter) const
+{
+   if (!available() || _slots[counter] < 0)
+      return -1;
+   return _totals[stage][counter];
+}
+
+void PerfStats::report(std::ostream& os, int64_t frames) const
+{
+   if (!available()) {
+      os <<"perf counters unavailable" <<(_error.empty() ? "" : ": ") <<_error <<std::endl;
+      return;
+   }
+   if (frames <= 0)
+      return;
+   for (size_t stage(0); stage < _names.size(); ++stage) {
+      const std::vector<uint64_t>& totals = _totals[stage];
+      os <<std::setw(8) <<_names[stage] <<":" <<std::fixed <<std::setprecision(2)
+         <<" " <<totals[CYCLES] / 1e6 / frames <<" Mcycles/frame";
+      if (_slots[INSTRUCTIONS] >= 0)
+         os <<", IPC " <<(totals[CYCLES] ? (double)totals[INSTRUCTIONS] / totals[CYCLES] : 0.);
+      if (_slots[LLC_MISSES] >= 0)
+         os <<", " <<std::setprecision(0) <<(double)totals[LLC_MISSES] / frames <<" LLC misses/frame";
+      if (_slots[BRANCH_MISSES] >= 0)
+         os <<", " <<std::setprecision(0) <<(double)totals[BRANCH_MISSES] / frames <<" branch misses/frame";
+      os.unsetf(std::ios::floatfield);
+      os <<std::setprecision(6) <<std::endl;
+   }
+}
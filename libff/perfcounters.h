@@ -0,0 +1,74 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hardware counters (perf_event_open) accumulated per pipeline stage, to
+// tell compute bound stages (low IPC from dependencies, branch misses) from
+// memory bound ones (LLC misses). The counters measure the thread that
+// opened them, in user space only; a Scope on any other thread is a no-op,
+// it would read that thread's counters across the other's work. When perf events are unavailable (no
+// PMU in a VM, perf_event_paranoid, seccomp) every Scope is a no-op and the
+// report says why.
+class PerfStats
+{
+public:
+   enum Counter
+   {
+      CYCLES,
+      INSTRUCTIONS,
+      LLC_MISSES,
+      BRANCH_MISSES,
+      COUNTERS
+   };
+
+   // Adds the counts between its construction and destruction to a stage.
+   class Scope
+   {
+   public:
+      Scope(PerfStats *stats, int stage);
+      ~Scope();
+
+   private:
+      Scope(const Scope&);
+      Scope& operator=(const Scope&);
+      PerfStats *_stats;
+      int _stage;
+      uint64_t _start[COUNTERS];
+   };
+
+   PerfStats(const std::vector<std::string>& stages);
+   virtual ~PerfStats();
+   // Opens the counters for the calling thread; false when unavailable.
+   bool open();
+   bool opened() const { return _opened; }
+   bool available() const { return _leader >= 0; }
+   // available, and called on the thread that opened the counters
+   bool counting() const { return available() && std::this_thread::get_id() == _thread; }
+   void report(std::ostream& os, int64_t frames) const;
+   // Count of a stage so far, -1 when the counter is not available.
+   int64_t total(int stage, Counter counter) const;
+
+private:
+   PerfStats(const PerfStats&);
+   PerfStats& operator=(const PerfStats&);
+   void read(uint64_t values[COUNTERS]) const;
+
+   std::vector<std::string> _names;
+   std::vector<std::vector<uint64_t>> _totals;
+   std::vector<int64_t> _samples;
+   int _leader = -1;
+   int _fds[COUNTERS];
+   // position of each counter in the group read, -1 when not supported
+   int _slots[COUNTERS];
+   int _members = 0;
+   bool _opened = false;
+   std::thread::id _thread;
+   std::string _error;
+};
+
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,220 @@
+#include "placement.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+static std::string readLine(const std::string& path)
+{
+   std::ifstream file(path.c_str());
+   std::string line;
+   std::getline(file, line);
+   return line;
+}
+
+std::vector<int> Topology::parseCpuList(const std::string& list)
+{
+   std::vector<int> cpus;
+   std::istringstream ranges(list);
+   std::string range;
+   while (std::getline(ranges, range, ',')) {
+      int first, last;
+      int fields = sscanf(range.c_str(), "%d-%d", &first, &last);
+      if (fields < 1)
+         throw std::runtime_error("Bad cpu list: " + list);
+      if (fields == 1)
+         last = first;
+      for (int cpu(first); cpu <= last; ++cpu)
+         cpus.push_back(cpu);
+   }
+   return cpus;
+}
+
+Topology Topology::detect()
+{
+   Topology topology;
+   const char *root = "/sys/devices/system/node";
+   if (DIR *dir = opendir(root)) {
+      while (struct dirent *entry = readdir(dir)) {
+         int id;
+         if (sscanf(entry->d_name, "node%d", &id) != 1)
+            continue;
+         Node node;
+         node.id = id;
+         node.cpus = parseCpuList(readLine(std::string(root) + "/" + entry->d_name + "/cpulist"));
+         // memory-only nodes have no CPUs to place threads on
+         if (!node.cpus.empty())
+            topology._nodes.push_back(node);
+      }
+      closedir(dir);
+   }
+   if (topology._nodes.empty()) {
+      Node node;
+      node.id = 0;
+      std::string online = readLine("/sys/devices/system/cpu/online");
+      if (!online.empty())
+         node.cpus = parseCpuList(online);
+      else
+         for (long cpu(0); cpu < sysconf(_SC_NPROCESSORS_ONLN); ++cpu)
+            node.cpus.push_back(cpu);
+      topology._nodes.push_back(node);
+   }
+   std::sort(topology._nodes.begin(), topology._nodes.end(),
+             [](const Node& a, const Node& b) { return a.id < b.id; });
+   return topology;
+}
+
+const Topology::Node *Topology::node(int id) const
+{
+   for (auto node(_nodes.begin()); node != _nodes.end(); ++node)
+      if (node->id == id)
+         return &*node;
+   return nullptr;
+}
+
+int Topology::nodeOf(int cpu) const
+{
+   for (auto node(_nodes.begin()); node != _nodes.end(); ++node)
+      if (std::find(node->cpus.begin(), node->cpus.end(), cpu) != node->cpus.end())
+         return node->id;
+   return -1;
+}
+
+static void describeCpus(std::ostream& os, const std::vector<int>& cpus)
+{
+   // back to the compact kernel notation
+   for (size_t i(0); i < cpus.size(); ) {
+      size_t j(i);
+      while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+         ++j;
+      os <<(i ? "," : "") <<cpus[i];
+      if (j > i)
+         os <<"-" <<cpus[j];
+      i = j + 1;
+   }
+}
+
+void Topology::describe(std::ostream& os) const
+{
+   os <<_nodes.size() <<" NUMA node(s):";
+   for (auto node(_nodes.begin()); node != _nodes.end(); ++node) {
+      os <<" node" <<node->id <<" cpus ";
+      describeCpus(os, node->cpus);
+   }
+   os <<std::endl;
+}
+
+Placement::Placement(const Topology& topology, const std::string& spec)
+: _topology(topology)
+{
+   std::istringstream entries(spec);
+   std::string entry;
+   while (std::getline(entries, entry, ':')) {
+      size_t equal = entry.find('=');
+      if (equal == std::string::npos)
+         throw std::runtime_error("Placement must be stage=cpus: " + entry);
+      std::string name = entry.substr(0, equal);
+      std::string cpus = entry.substr(equal + 1);
+
+      int stage(0);
+      while (stage < STAGES && name != stageName((Stage)stage))
+         ++stage;
+      if (stage == STAGES)
+         throw std::runtime_error("Unknown pipeline stage " + name);
+
+      int id;
+      if (sscanf(cpus.c_str(), "node%d", &id) == 1) {
+         const Topology::Node *node = _topology.node(id);
+         if (!node)
+            throw std::runtime_error("No CPUs on " + cpus);
+         _cpus[stage] = node->cpus;
+      }
+      else
+         _cpus[stage] = Topology::parseCpuList(cpus);
+   }
+}
+
+const char *Placement::stageName(Stage stage)
+{
+   static const char *names[STAGES] = {"decode", "encode"};
+   return names[stage];
+}
+
+bool Placement::empty() const
+{
+   for (int stage(0); stage < STAGES; ++stage)
+      if (!_cpus[stage].empty())
+         return false;
+   return true;
+}
+
+void Placement::pin(Stage stage) const
+{
+   const std::vector<int>& cpus = _cpus[stage];
+   if (cpus.empty())
+      return;
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   for (auto cpu(cpus.begin()); cpu != cpus.end(); ++cpu)
+      if (*cpu < CPU_SETSIZE)
+         CPU_SET(*cpu, &set);
+   int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+   if (ret != 0)
+      throw std::runtime_error(std::string("Could not pin the ") + stageName(stage) + " stage");
+}
+
+Placement::Scope::Scope(const Placement& placement, Stage stage)
+: _pinned(!placement._cpus[stage].empty())
+{
+   if (_pinned) {
+      pthread_getaffinity_np(pthread_self(), sizeof(_previous), &_previous);
+      placement.pin(stage);
+   }
+}
+
+Placement::Scope::~Scope()
+{
+   if (_pinned)
+      pthread_setaffinity_np(pthread_self(), sizeof(_previous), &_previous);
+}
+
+int Placement::nodeOf(Stage stage) const
+{
+   const std::vector<int>& cpus = _cpus[stage];
+   if (cpus.empty())
+      return -1;
+   int node = _topology.nodeOf(cpus.front());
+   for (auto cpu(cpus.begin()); cpu != cpus.end(); ++cpu)
+      if (_topology.nodeOf(*cpu) != node)
+         return -1;
+   return node;
+}
+
+int Placement::frameNode() const
+{
+   if (!_cpus[ENCODE].empty())
+      return nodeOf(ENCODE);
+   return nodeOf(DECODE);
+}
+
+void Placement::describe(std::ostream& os) const
+{
+   for (int stage(0); stage < STAGES; ++stage) {
+      os <<stageName((Stage)stage) <<" ";
+      if (_cpus[stage].empty())
+         os <<"unpinned";
+      else
+         describeCpus(os, _cpus[stage]);
+      os <<(stage + 1 < STAGES ? ", " : "");
+   }
+   os <<", frames on " <<(frameNode() >= 0 ? "node " + std::to_string(frameNode()) : std::string("any node"))
+      <<std::endl;
+}
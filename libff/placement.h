@@ -0,0 +1,86 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+
+// NUMA nodes and their CPUs as the kernel reports them in sysfs; a machine
+// without NUMA support is one node holding every online CPU.
+class Topology
+{
+public:
+   struct Node
+   {
+      int id;
+      std::vector<int> cpus;
+   };
+
+   static Topology detect();
+   const std::vector<Node>& nodes() const { return _nodes; }
+   const Node *node(int id) const;
+   int nodeOf(int cpu) const;
+   void describe(std::ostream& os) const;
+
+   // parses a kernel cpu list such as "0-3,8,10-11"
+   static std::vector<int> parseCpuList(const std::string& list);
+
+private:
+   std::vector<Node> _nodes;
+};
+
+// CPU sets of the pipeline stages of one job. In this pipeline decoding and
+// filtering share the reading thread, and every rendition encodes and
+// writes on its own thread. Threads started by libavcodec inherit the
+// affinity of the thread that opens the codec, so a stage is pinned before
+// its Filter or Muxer is constructed.
+//
+// A spec lists stage=cpus pairs separated by ':', where cpus is a cpu list
+// or nodeN for all the CPUs of a node, e.g. "decode=0-3:encode=node1".
+// Unlisted stages are not pinned.
+class Placement
+{
+public:
+   enum Stage
+   {
+      DECODE,
+      ENCODE,
+      STAGES
+   };
+
+   // Pins the calling thread to a stage and restores its previous affinity
+   // when it goes out of scope.
+   class Scope
+   {
+   public:
+      Scope(const Placement& placement, Stage stage);
+      ~Scope();
+
+   private:
+      Scope(const Scope&);
+      Scope& operator=(const Scope&);
+      cpu_set_t _previous;
+      bool _pinned;
+   };
+
+   Placement(const Topology& topology, const std::string& spec = std::string());
+   bool empty() const;
+   // Pins the calling thread to the CPUs of stage; no-op for an unlisted stage.
+   void pin(Stage stage) const;
+   // The node the frames should live on: the node of the encode CPUs, which
+   // read them last, or of the decode CPUs; -1 when they span several nodes.
+   int frameNode() const;
+   void describe(std::ostream& os) const;
+
+   static const char *stageName(Stage stage);
+
+private:
+   int nodeOf(Stage stage) const;
+
+   const Topology& _topology;
+   std::vector<int> _cpus[STAGES];
+};
+
+#endif // PLACEMENT_H
@@ -0,0 +1,443 @@
+#include "qualitymonitor.h"
+#include "trace.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// identical planes: the PSNR is infinite, reported as this many dB
+static const double PSNR_MAX = 100.;
+// SSIM window, non-overlapping
+static const int WINDOW = 8;
+
+static uint64_t rowSse8(const uint8_t *a, const uint8_t *b, int width)
+{
+   uint64_t sse(0);
+   int x(0);
+#ifdef __SSE2__
+   // differences widened to 16 bits, squared and summed in pairs by pmaddwd
+   const __m128i zero = _mm_setzero_si128();
+   __m128i sum = zero;
+   for (; x + 16 <= width; x += 16) {
+      __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+      __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+      __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+      __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+      __m128i squares = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+      sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(squares, zero),
+                                             _mm_unpackhi_epi32(squares, zero)));
+   }
+   uint64_t lanes[2];
+   _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+   sse = lanes[0] + lanes[1];
+#endif
+   for (; x < width; ++x) {
+      int d = a[x] - b[x];
+      sse += d * d;
+   }
+   return sse;
+}
+
+// up to 12 bits per component: a difference squared and summed in pairs
+// still fits pmaddwd's 32 bit lanes
+static uint64_t rowSse16(const uint16_t *a, const uint16_t *b, int width, bool narrow)
+{
+   uint64_t sse(0);
+   int x(0);
+#ifdef __SSE2__
+   if (narrow) {
+      const __m128i zero = _mm_setzero_si128();
+      __m128i sum = zero;
+      for (; x + 8 <= width; x += 8) {
+         __m128i d = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x)));
+         __m128i squares = _mm_madd_epi16(d, d);
+         sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(squares, zero),
+                                                _mm_unpackhi_epi32(squares, zero)));
+      }
+      uint64_t lanes[2];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+      sse = lanes[0] + lanes[1];
+   }
+#endif
+   for (; x < width; ++x) {
+      int64_t d = a[x] - b[x];
+      sse += d * d;
+   }
+   return sse;
+}
+
+// sum a, sum b, sum a², sum b², sum ab over a WINDOW x WINDOW block
+static void windowSums8(const uint8_t *a, int aStride, const uint8_t *b, int bStride, int64_t sums[5])
+{
+#ifdef __SSE2__
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i ones = _mm_set1_epi16(1);
+   __m128i sa = zero, sb = zero, saa = zero, sbb = zero, sab = zero;
+   for (int y(0); y < WINDOW; ++y) {
+      __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + y * aStride)), zero);
+      __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + y * bStride)), zero);
+      sa = _mm_add_epi32(sa, _mm_madd_epi16(va, ones));
+      sb = _mm_add_epi32(sb, _mm_madd_epi16(vb, ones));
+      saa = _mm_add_epi32(saa, _mm_madd_epi16(va, va));
+      sbb = _mm_add_epi32(sbb, _mm_madd_epi16(vb, vb));
+      sab = _mm_add_epi32(sab, _mm_madd_epi16(va, vb));
+   }
+   __m128i vectors[5] = {sa, sb, saa, sbb, sab};
+   for (int i(0); i < 5; ++i) {
+      int32_t lanes[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vectors[i]);
+      sums[i] = (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+   }
+#else
+   std::fill(sums, sums + 5, 0);
+   for (int y(0); y < WINDOW; ++y)
+      for (int x(0); x < WINDOW; ++x) {
+         int va = a[y * aStride + x], vb = b[y * bStride + x];
+         sums[0] += va;
+         sums[1] += vb;
+         sums[2] += va * va;
+         sums[3] += vb * vb;
+         sums[4] += va * vb;
+      }
+#endif
+}
+
+static void windowSums16(const uint16_t *a, int aStride, const uint16_t *b, int bStride, int64_t sums[5])
+{
+   std::fill(sums, sums + 5, 0);
+   for (int y(0); y < WINDOW; ++y)
+      for (int x(0); x < WINDOW; ++x) {
+         int64_t va = a[y * aStride + x], vb = b[y * bStride + x];
+         sums[0] += va;
+         sums[1] += vb;
+         sums[2] += va * va;
+         sums[3] += vb * vb;
+         sums[4] += va * vb;
+      }
+}
+
+static double windowSsim(const int64_t sums[5], double c1, double c2)
+{
+   const double n = WINDOW * WINDOW;
+   double muA = sums[0] / n, muB = sums[1] / n;
+   double varA = sums[2] / n - muA * muA;
+   double varB = sums[3] / n - muB * muB;
+   double cov = sums[4] / n - muA * muB;
+   return (2. * muA * muB + c1) * (2. * cov + c2) / ((muA * muA + muB * muB + c1) * (varA + varB + c2));
+}
+
+static double psnr(uint64_t sse, int64_t samples, int maxValue)
+{
+   if (!sse)
+      return PSNR_MAX;
+   return std::min(PSNR_MAX, 10. * log10((double)maxValue * maxValue * samples / sse));
+}
+
+QualityMonitor::QualityMonitor(const AVCodecContext *encoder, const QualityConfig& config)
+: _config(config)
+, _width(encoder->width)
+, _height(encoder->height)
+, _pixFmt(encoder->pix_fmt)
+{
+   if (_config.interval <= 0)
+      throw std::runtime_error("Quality monitor interval must be positive");
+   const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(_pixFmt);
+   int linesizes[4];
+   if (!desc || av_image_fill_linesizes(linesizes, _pixFmt, _width) < 0)
+      throw std::runtime_error("Quality monitor: unknown pixel format");
+   int depth = desc->comp[0].depth_minus1 + 1;
+   _bytesPerComponent = depth > 8 ? 2 : 1;
+   _maxValue = (1 << depth) - 1;
+   if (linesizes[0] != _width * _bytesPerComponent)
+      throw std::runtime_error(std::string("Quality monitor needs a planar pixel format, not ")
+                               + desc->name);
+
+   const AVCodecDescriptor *codecDesc = avcodec_descriptor_get(encoder->codec_id);
+   _intraOnly = codecDesc && (codecDesc->props & AV_CODEC_PROP_INTRA_ONLY);
+
+   AVCodec *codec = avcodec_find_decoder(encoder->codec_id);
+   if (!codec)
+      throw std::runtime_error("Quality monitor: no decoder for the encoder output");
+   _decoder.reset(avcodec_alloc_context3(codec));
+   if (!_decoder)
+      throw std::runtime_error("Could not allocate decoder context");
+   _decoder->width = _width;
+   _decoder->height = _height;
+   _decoder->pix_fmt = _pixFmt;
+   if (encoder->extradata_size > 0) {
+      _decoder->extradata = static_cast<uint8_t*>(av_mallocz(encoder->extradata_size
+                                                              + FF_INPUT_BUFFER_PADDING_SIZE));
+      if (!_decoder->extradata)
+         throw std::runtime_error("Could not allocate codec extradata");
+      memcpy(_decoder->extradata, encoder->extradata, encoder->extradata_size);
+      _decoder->extradata_size = encoder->extradata_size;
+   }
+   // frame threads would hold back a frame per thread
+   _decoder->thread_type = FF_THREAD_SLICE;
+   if (avcodec_open2(_decoder.get(), codec, NULL) < 0)
+      throw std::runtime_error("Could not open the quality monitor decoder");
+   _frame = allocFrame();
+
+   if (!_config.csv.empty()) {
+      _csv = fopen(_config.csv.c_str(), "w");
+      if (!_csv)
+         throw std::runtime_error("Could not open " + _config.csv);
+      static const char *const names[] = {"y", "u", "v", "a"};
+      int planes(0);
+      while (planes < 4 && linesizes[planes])
+         ++planes;
+      fprintf(_csv, "frame,pts");
+      for (int plane(0); plane < planes; ++plane)
+         fprintf(_csv, ",psnr_%s", names[plane]);
+      fprintf(_csv, ",psnr");
+      for (int plane(0); plane < planes; ++plane)
+         fprintf(_csv, ",ssim_%s", names[plane]);
+      fprintf(_csv, ",ssim\n");
+   }
+   _thread = std::thread(&QualityMonitor::run, this);
+}
+
+QualityMonitor::~QualityMonitor()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closing = true;
+   }
+   _cond.notify_all();
+   _thread.join();
+   if (_csv)
+      fclose(_csv);
+}
+
+void QualityMonitor::addSource(int64_t frame, int64_t pts, const uint8_t *const data[4], const int linesizes[4])
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_failed)
+         return;
+      if ((int)_sources.size() >= _config.queueDepth) {
+         ++_skipped;
+         return;
+      }
+   }
+   TraceSpan span("quality copy", pts);
+   std::unique_ptr<Source> source(new Source);
+   source->frame = frame;
+   int size = av_image_alloc(source->data, source->linesizes, _width, _height, _pixFmt, 32);
+   if (size < 0)
+      throw std::runtime_error("Could not allocate quality monitor picture");
+   source->buffer.reset(source->data[0]);
+   av_image_copy(source->data, source->linesizes, const_cast<const uint8_t **>(data), linesizes,
+                 _pixFmt, _width, _height);
+   std::lock_guard<std::mutex> lock(_mutex);
+   _sources[pts] = std::move(source);
+}
+
+void QualityMonitor::addPacket(const AVPacket& pkt)
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   if (_failed)
+      return;
+   auto source = _sources.find(pkt.pts);
+   if (_intraOnly && source == _sources.end())
+      return;
+   if (!_intraOnly && _resync && !(pkt.flags & AV_PKT_FLAG_KEY))
+      return;
+   if ((int)_queue.size() >= _config.queueDepth) {
+      // behind: the encoder never waits for the monitor
+      if (source != _sources.end()) {
+         _sources.erase(source);
+         ++_skipped;
+      }
+      _resync = !_intraOnly;
+      return;
+   }
+   lock.unlock();
+
+   std::unique_ptr<Queued> queued(new Queued);
+   if (av_new_packet(&queued->packet, pkt.size) < 0)
+      throw std::runtime_error("Could not allocate packet");
+   memcpy(queued->packet.data, pkt.data, pkt.size);
+   queued->packet.pts = pkt.pts;
+   queued->packet.dts = pkt.dts;
+   queued->packet.flags = pkt.flags;
+
+   lock.lock();
+   queued->flush = _resync;
+   _resync = false;
+   _queue.push_back(std::move(queued));
+   _cond.notify_all();
+}
+
+void QualityMonitor::drain()
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   _cond.wait(lock, [&] { return (_queue.empty() && !_busy) || _failed; });
+}
+
+void QualityMonitor::run()
+{
+   Trace::setThreadName("quality");
+   std::unique_lock<std::mutex> lock(_mutex);
+   for (;;) {
+      _cond.wait(lock, [&] { return !_queue.empty() || _closing; });
+      if (_closing)
+         return;
+      std::unique_ptr<Queued> queued(std::move(_queue.front()));
+      _queue.pop_front();
+      _busy = true;
+      lock.unlock();
+      try {
+         decode(*queued);
+      }
+      catch (std::exception& e) {
+         fprintf(stderr, "Quality monitor stopped: %s\n", e.what());
+         lock.lock();
+         _failed = true;
+         _queue.clear();
+         _sources.clear();
+         lock.unlock();
+      }
+      queued.reset();
+      lock.lock();
+      _busy = false;
+      _cond.notify_all();
+   }
+}
+
+void QualityMonitor::decode(Queued& queued)
+{
+   if (queued.flush)
+      avcodec_flush_buffers(_decoder.get());
+   avcodec_get_frame_defaults(_frame.get());
+   int gotFrame(0);
+   {
+      TraceSpan span("quality decode", queued.packet.pts);
+      if (avcodec_decode_video2(_decoder.get(), _frame.get(), &gotFrame, &queued.packet) < 0)
+         throw std::runtime_error("Could not decode an encoded frame");
+   }
+   if (!gotFrame)
+      return;
+   int64_t pts = av_frame_get_best_effort_timestamp(_frame.get());
+   std::unique_ptr<Source> source;
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto match = _sources.find(pts);
+      if (match != _sources.end())
+         source = std::move(match->second);
+      // decoded in pts order: older sources will never be matched
+      _sources.erase(_sources.begin(), _sources.upper_bound(pts));
+   }
+   if (source)
+      compare(*source, _frame.get(), pts);
+}
+
+void QualityMonitor::compare(const Source& source, const AVFrame *decoded, int64_t pts)
+{
+   TraceSpan span("quality compare", pts);
+   const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(_pixFmt);
+   int rowBytes[4];
+   av_image_fill_linesizes(rowBytes, _pixFmt, _width);
+   // the usual SSIM constants for the component range
+   double c1 = (0.01 * _maxValue) * (0.01 * _maxValue);
+   double c2 = (0.03 * _maxValue) * (0.03 * _maxValue);
+
+   QualitySample sample;
+   sample.frame = source.frame;
+   sample.pts = pts;
+   uint64_t frameSse(0);
+   int64_t frameSamples(0);
+   double ssimWeighted(0.);
+   for (int plane(0); plane < 4 && rowBytes[plane]; ++plane) {
+      bool chroma = plane == 1 || plane == 2;
+      int width = chroma ? -((-_width) >> desc->log2_chroma_w) : _width;
+      int height = chroma ? -((-_height) >> desc->log2_chroma_h) : _height;
+      const uint8_t *a = source.data[plane];
+      const uint8_t *b = decoded->data[plane];
+      int aStride = source.linesizes[plane], bStride = decoded->linesize[plane];
+
+      uint64_t sse(0);
+      for (int y(0); y < height; ++y)
+         sse += _bytesPerComponent == 1
+                ? rowSse8(a + y * aStride, b + y * bStride, width)
+                : rowSse16(reinterpret_cast<const uint16_t*>(a + y * aStride),
+                           reinterpret_cast<const uint16_t*>(b + y * bStride), width, _maxValue < 4096);
+
+      double ssim(0.);
+      int windows(0);
+      int64_t sums[5];
+      for (int y(0); y + WINDOW <= height; y += WINDOW)
+         for (int x(0); x + WINDOW <= width; x += WINDOW, ++windows) {
+            if (_bytesPerComponent == 1)
+               windowSums8(a + y * aStride + x, aStride, b + y * bStride + x, bStride, sums);
+            else
+               windowSums16(reinterpret_cast<const uint16_t*>(a + y * aStride) + x, aStride / 2,
+                            reinterpret_cast<const uint16_t*>(b + y * bStride) + x, bStride / 2, sums);
+            ssim += windowSsim(sums, c1, c2);
+         }
+      ssim = windows ? ssim / windows : 1.;
+
+      int64_t samples = (int64_t)width * height;
+      sample.psnr[plane] = psnr(sse, samples, _maxValue);
+      sample.ssim[plane] = ssim;
+      sample.planes = plane + 1;
+      frameSse += sse;
+      frameSamples += samples;
+      ssimWeighted += ssim * samples;
+   }
+   sample.framePsnr = psnr(frameSse, frameSamples, _maxValue);
+   sample.frameSsim = frameSamples ? ssimWeighted / frameSamples : 1.;
+
+   if (_csv) {
+      fprintf(_csv, "%lld,%lld", (long long)sample.frame, (long long)sample.pts);
+      for (int plane(0); plane < sample.planes; ++plane)
+         fprintf(_csv, ",%.3f", sample.psnr[plane]);
+      fprintf(_csv, ",%.3f", sample.framePsnr);
+      for (int plane(0); plane < sample.planes; ++plane)
+         fprintf(_csv, ",%.5f", sample.ssim[plane]);
+      fprintf(_csv, ",%.5f\n", sample.frameSsim);
+   }
+   std::lock_guard<std::mutex> lock(_mutex);
+   _samples.push_back(sample);
+}
+
+void QualityMonitor::report(std::ostream& os, const char *name) const
+{
+   os <<name <<" quality over " <<_samples.size() <<" sampled frames (every " <<_config.interval
+      <<", " <<_skipped <<" skipped)";
+   if (_samples.empty()) {
+      os <<std::endl;
+      return;
+   }
+   double psnrSum(0.), ssimSum(0.);
+   double planePsnr[4] = {0.};
+   const QualitySample *worstPsnr = &_samples[0], *worstSsim = &_samples[0];
+   for (auto sample(_samples.begin()); sample != _samples.end(); ++sample) {
+      psnrSum += sample->framePsnr;
+      ssimSum += sample->frameSsim;
+      for (int plane(0); plane < sample->planes; ++plane)
+         planePsnr[plane] += sample->psnr[plane];
+      if (sample->framePsnr < worstPsnr->framePsnr)
+         worstPsnr = &*sample;
+      if (sample->frameSsim < worstSsim->frameSsim)
+         worstSsim = &*sample;
+   }
+   double n = _samples.size();
+   os <<": PSNR mean " <<psnrSum / n <<" dB (";
+   for (int plane(0); plane < _samples[0].planes; ++plane)
+      os <<(plane ? " " : "") <<"YUVA"[plane] <<" " <<planePsnr[plane] / n;
+   os <<"), min " <<worstPsnr->framePsnr <<" dB at frame " <<worstPsnr->frame
+      <<"; SSIM mean " <<ssimSum / n <<", min " <<worstSsim->frameSsim <<" at frame " <<worstSsim->frame
+      <<std::endl;
+}
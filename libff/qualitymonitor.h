@@ -0,0 +1,119 @@
+#ifndef QUALITYMONITOR_H
+#define QUALITYMONITOR_H
+
+#include "avptr.h"
+#include "libav.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct QualityConfig
+{
+   // compare every interval-th encoded frame, 0 for no monitor
+   int interval = 0;
+   // pictures and packets waiting for the monitor; past that a sample is
+   // skipped rather than the encoder kept waiting
+   int queueDepth = 8;
+   // one line per sampled frame, empty for none
+   std::string csv;
+};
+
+// PSNR and SSIM of one sampled frame, per plane and over the frame with the
+// planes weighted by their size.
+struct QualitySample
+{
+   int64_t frame = 0;
+   int64_t pts = 0;
+   int planes = 0;
+   double psnr[4] = {0.};
+   double ssim[4] = {0.};
+   double framePsnr = 0.;
+   double frameSsim = 0.;
+};
+
+// Decodes the encoder output on a thread of its own and compares sampled
+// frames with the pictures the encoder was given, so the quality of the
+// encoder settings is known without a second decode-and-compare pass.
+//
+// Intra-only codecs decode the sampled packets alone. Other codecs need
+// every packet for their references; when the queue is full, packets are
+// dropped up to the next key frame instead. Supports planar formats of 8
+// to 16 bits per component.
+class QualityMonitor
+{
+public:
+   // encoder: open, its parameters set up the decoder
+   QualityMonitor(const AVCodecContext *encoder, const QualityConfig& config);
+   virtual ~QualityMonitor();
+   bool sampled(int64_t frame) const { return frame % _config.interval == 0; }
+   // A copy of the picture handed to the encoder as frame number frame,
+   // matched with the decoded packet of the same pts.
+   void addSource(int64_t frame, int64_t pts, const uint8_t *const data[4], const int linesizes[4]);
+   // A copy of an encoded packet, ignored when no source waits for it and
+   // the codec doesn't need it for references.
+   void addPacket(const AVPacket& pkt);
+   // Waits for the queued packets to be compared. Frames an inter-frame
+   // decoder still holds back are left out. A decode error stops the
+   // monitor, not the encode: it is reported on stderr.
+   void drain();
+   const std::vector<QualitySample>& samples() const { return _samples; }
+   int skipped() const { return _skipped; }
+   // after drain
+   void report(std::ostream& os, const char *name) const;
+
+private:
+   struct Source
+   {
+      int64_t frame;
+      uint8_t *data[4];
+      int linesizes[4];
+      AvMallocPtr<uint8_t> buffer;
+   };
+   struct Queued
+   {
+      Queued() { av_init_packet(&packet); packet.data = NULL; packet.size = 0; }
+      ~Queued() { av_free_packet(&packet); }
+      AVPacket packet;
+      // the packets before it were dropped, the decoder restarts here
+      bool flush = false;
+   };
+
+   QualityMonitor(const QualityMonitor&);
+   QualityMonitor& operator=(const QualityMonitor&);
+   void run();
+   void decode(Queued& queued);
+   void compare(const Source& source, const AVFrame *decoded, int64_t pts);
+
+   const QualityConfig _config;
+   int _width;
+   int _height;
+   enum AVPixelFormat _pixFmt;
+   int _bytesPerComponent;
+   int _maxValue;
+   bool _intraOnly;
+   CodecContextPtr _decoder;
+   FramePtr _frame;
+   FILE *_csv = nullptr;
+
+   std::map<int64_t, std::unique_ptr<Source>> _sources;
+   std::deque<std::unique_ptr<Queued>> _queue;
+   bool _busy = false;
+   bool _resync = false;
+   bool _closing = false;
+   bool _failed = false;
+   int _skipped = 0;
+   std::vector<QualitySample> _samples;
+   std::mutex _mutex;
+   std::condition_variable _cond;
+   std::thread _thread;
+};
+
+#endif // QUALITYMONITOR_H
@@ -0,0 +1,175 @@
+#include "shmring.h"
+
+#include <cstring>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t align64(uint64_t value)
+{
+   return (value + 63) & ~uint64_t(63);
+}
+
+ShmRingWriter::ShmRingWriter(const char *name, int slotCount, int slotSize,
+                             int width, int height, int pixFmt)
+: _name(name)
+{
+   if (slotCount <= 0 || slotSize <= 0)
+      throw std::runtime_error("Invalid shared memory ring geometry");
+
+   uint64_t slotsOffset = align64(sizeof(ShmRingHeader));
+   uint64_t slotStride = align64(sizeof(ShmSlotHeader)) + align64(slotSize);
+   _mapSize = slotsOffset + slotStride * slotCount;
+
+   int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+   if (fd < 0)
+      throw std::runtime_error("Could not create shared memory ring " + _name);
+   if (ftruncate(fd, _mapSize) < 0) {
+      ::close(fd);
+      throw std::runtime_error("Could not size shared memory ring " + _name);
+   }
+   void *map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (map == MAP_FAILED)
+      throw std::runtime_error("Could not map shared memory ring " + _name);
+
+   // the mapping starts zeroed, so every slot sequence is 0 (never written)
+   _header = new (map) ShmRingHeader;
+   _header->version = SHM_RING_VERSION;
+   _header->slotCount = slotCount;
+   _header->slotSize = slotSize;
+   _header->slotStride = slotStride;
+   _header->slotsOffset = slotsOffset;
+   _header->width = width;
+   _header->height = height;
+   _header->pixFmt = pixFmt;
+   _header->published.store(0);
+   _header->closed.store(0);
+   // consumers check the magic last
+   std::atomic_thread_fence(std::memory_order_release);
+   _header->magic = SHM_RING_MAGIC;
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+   _header->closed.store(1, std::memory_order_release);
+   munmap(_header, _mapSize);
+   // mapped consumers keep their view, new ones can no longer attach
+   shm_unlink(_name.c_str());
+}
+
+uint8_t *ShmRingWriter::acquire()
+{
+   uint8_t *base = reinterpret_cast<uint8_t*>(_header) + _header->slotsOffset
+                   + (_next % _header->slotCount) * _header->slotStride;
+   _slot = reinterpret_cast<ShmSlotHeader*>(base);
+   _slot->sequence.store(2 * _next + 1, std::memory_order_relaxed);
+   // the odd sequence must be visible before any byte of the frame changes
+   std::atomic_thread_fence(std::memory_order_release);
+   return base + align64(sizeof(ShmSlotHeader));
+}
+
+void ShmRingWriter::commit(int64_t pts, int size, const int offsets[4], const int linesizes[4])
+{
+   if (!_slot)
+      throw std::runtime_error("Shared memory ring commit without acquire");
+   _slot->pts = pts;
+   _slot->size = size;
+   for (int i(0); i < 4; ++i) {
+      _slot->offsets[i] = offsets[i];
+      _slot->linesizes[i] = linesizes[i];
+   }
+   _slot->sequence.store(2 * _next + 2, std::memory_order_release);
+   _header->published.store(++_next, std::memory_order_release);
+   _slot = nullptr;
+}
+
+ShmRingReader::ShmRingReader(const char *name)
+{
+   int fd = shm_open(name, O_RDONLY, 0);
+   if (fd < 0)
+      throw std::runtime_error(std::string("Could not open shared memory ring ") + name);
+   struct stat st;
+   if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+      ::close(fd);
+      throw std::runtime_error(std::string("Shared memory ring is not initialized: ") + name);
+   }
+   _mapSize = st.st_size;
+   void *map = mmap(NULL, _mapSize, PROT_READ, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (map == MAP_FAILED)
+      throw std::runtime_error(std::string("Could not map shared memory ring ") + name);
+
+   _header = static_cast<ShmRingHeader*>(map);
+   if (_header->magic != SHM_RING_MAGIC || _header->version != SHM_RING_VERSION) {
+      munmap(map, _mapSize);
+      throw std::runtime_error(std::string("Not a compatible shared memory ring: ") + name);
+   }
+   std::atomic_thread_fence(std::memory_order_acquire);
+   // start with the oldest frame still in the ring
+   uint64_t published = _header->published.load(std::memory_order_acquire);
+   _cursor = published > _header->slotCount ? published - _header->slotCount : 0;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+   munmap(_header, _mapSize);
+}
+
+const ShmSlotHeader *ShmRingReader::slot(uint64_t index) const
+{
+   const uint8_t *base = reinterpret_cast<const uint8_t*>(_header) + _header->slotsOffset
+                         + (index % _header->slotCount) * _header->slotStride;
+   return reinterpret_cast<const ShmSlotHeader*>(base);
+}
+
+bool ShmRingReader::next(ShmFrame& frame, int timeoutMs)
+{
+   auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+   for (;;) {
+      uint64_t published = _header->published.load(std::memory_order_acquire);
+      if (published - _cursor > _header->slotCount) {
+         // lapped by the producer
+         _dropped += published - _header->slotCount - _cursor;
+         _cursor = published - _header->slotCount;
+      }
+      if (_cursor < published) {
+         const ShmSlotHeader *header = slot(_cursor);
+         if (header->sequence.load(std::memory_order_acquire) != 2 * _cursor + 2) {
+            // overwritten between the two loads, catch up
+            ++_dropped;
+            ++_cursor;
+            continue;
+         }
+         const uint8_t *data = reinterpret_cast<const uint8_t*>(header) + align64(sizeof(ShmSlotHeader));
+         for (int i(0); i < 4; ++i) {
+            frame.data[i] = header->linesizes[i] ? data + header->offsets[i] : nullptr;
+            frame.linesizes[i] = header->linesizes[i];
+         }
+         frame.pts = header->pts;
+         frame.size = header->size;
+         frame.index = _cursor++;
+         if (valid(frame))
+            return true;
+         ++_dropped;
+         continue;
+      }
+      if (_header->closed.load(std::memory_order_acquire)
+          || std::chrono::steady_clock::now() >= deadline)
+         return false;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+   }
+}
+
+bool ShmRingReader::valid(const ShmFrame& frame) const
+{
+   // order the caller's reads of the frame before the sequence check
+   std::atomic_thread_fence(std::memory_order_acquire);
+   return slot(frame.index)->sequence.load(std::memory_order_relaxed) == 2 * frame.index + 2;
+}
@@ -0,0 +1,106 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Single producer / multi consumer ring of frame slots in POSIX shared memory
+// (/dev/shm/<name>). The producer never waits for consumers: a consumer that
+// falls more than slotCount frames behind skips ahead and counts the frames
+// it lost. Consumers read frames in place; every slot carries a sequence
+// number, odd while the producer rewrites it, so a consumer can tell after
+// the fact whether the frame it looked at was overwritten.
+//
+// Layout: ShmRingHeader, then slotCount slots of slotStride bytes, each an
+// ShmSlotHeader followed by the frame planes. Offsets are 64 byte aligned.
+// This file does not depend on libav so consumers can use it on its own.
+
+const uint32_t SHM_RING_MAGIC = 0x47524646; // "FFRG"
+const uint32_t SHM_RING_VERSION = 1;
+
+struct ShmRingHeader
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t slotCount;
+   uint32_t slotSize;     // frame bytes a slot can hold
+   uint64_t slotStride;   // distance between slot headers
+   uint64_t slotsOffset;  // offset of the first slot header
+   int32_t width;
+   int32_t height;
+   int32_t pixFmt;        // AVPixelFormat of the frames
+   std::atomic<uint64_t> published; // frame n lives in slot n % slotCount
+   std::atomic<uint32_t> closed;
+};
+
+struct ShmSlotHeader
+{
+   std::atomic<uint64_t> sequence; // 2n + 1 while frame n is written, 2n + 2 once complete
+   int64_t pts;
+   uint32_t size;
+   int32_t linesizes[4];
+   uint32_t offsets[4];   // plane offsets from the slot data
+};
+
+struct ShmFrame
+{
+   const uint8_t *data[4];
+   int linesizes[4];
+   int64_t pts;
+   uint32_t size;
+   uint64_t index;
+};
+
+class ShmRingWriter
+{
+public:
+   ShmRingWriter(const char *name, int slotCount, int slotSize,
+                 int width, int height, int pixFmt);
+   virtual ~ShmRingWriter();
+
+   // Slot data of the next frame; fill it and commit it.
+   uint8_t *acquire();
+   void commit(int64_t pts, int size, const int offsets[4], const int linesizes[4]);
+   int slotSize() const { return _header->slotSize; }
+   uint64_t published() const { return _next; }
+
+private:
+   ShmRingWriter(const ShmRingWriter&);
+   ShmRingWriter& operator=(const ShmRingWriter&);
+
+   std::string _name;
+   size_t _mapSize = 0;
+   ShmRingHeader *_header = nullptr;
+   ShmSlotHeader *_slot = nullptr;
+   uint64_t _next = 0;
+};
+
+class ShmRingReader
+{
+public:
+   ShmRingReader(const char *name);
+   virtual ~ShmRingReader();
+
+   // Waits up to timeoutMs for the next frame; false on timeout or once the
+   // producer closed the ring and every frame was consumed.
+   bool next(ShmFrame& frame, int timeoutMs = 1000);
+   // True while the frame returned by next() has not been overwritten.
+   bool valid(const ShmFrame& frame) const;
+
+   const ShmRingHeader& header() const { return *_header; }
+   uint64_t dropped() const { return _dropped; }
+
+private:
+   ShmRingReader(const ShmRingReader&);
+   ShmRingReader& operator=(const ShmRingReader&);
+   const ShmSlotHeader *slot(uint64_t index) const;
+
+   size_t _mapSize = 0;
+   ShmRingHeader *_header = nullptr;
+   uint64_t _cursor = 0;
+   uint64_t _dropped = 0;
+};
+
+#endif // SHMRING_H
@@ -0,0 +1,194 @@
+#include "statistics.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+static const char SIDECAR_MAGIC[8] = {'F', 'F', 'S', 'T', 'A', 'T', 'S', '1'};
+
+Analyzer::Analyzer(const char *src, const AnalysisConfig& config)
+: _config(config)
+, _lastHistogram(FrameStats::BINS)
+{
+   initLibav();
+   _frame = allocFrame();
+
+   AVCodec *dec;
+   AVFormatContext *fmtCtx = NULL;
+   if (avformat_open_input(&fmtCtx, src, NULL, NULL) < 0)
+      throw std::runtime_error("Cannot open input file\n");
+   _fmtCtx.reset(fmtCtx);
+   if (avformat_find_stream_info(_fmtCtx.get(), NULL) < 0)
+      throw std::runtime_error("Cannot find stream information\n");
+   int index = av_find_best_stream(_fmtCtx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, &dec, 0);
+   if (index < 0)
+      throw std::runtime_error("Cannot find a video stream in the input file");
+   _stream = _fmtCtx->streams[index];
+   _decCtx = _stream->codec;
+   if (_fmtCtx->duration != AV_NOPTS_VALUE)
+      _duration = (double)_fmtCtx->duration / AV_TIME_BASE;
+
+   // statistics don't need every pixel right: reduced resolution, no loop
+   // filter and the decoder shortcuts, on all cores
+   _decCtx->lowres = std::min(_config.lowres, (int)dec->max_lowres);
+   _decCtx->skip_loop_filter = AVDISCARD_ALL;
+   _decCtx->flags2 |= CODEC_FLAG2_FAST;
+   _decCtx->thread_count = 0;
+   if (avcodec_open2(_decCtx, dec, NULL) < 0)
+      throw std::runtime_error("Cannot open video decoder\n");
+   _decoder.reset(_decCtx);
+}
+
+Analyzer::~Analyzer()
+{
+}
+
+int Analyzer::run(const char *sidecar)
+{
+   FILE *file = fopen(sidecar, "wb");
+   if (!file)
+      throw std::runtime_error(std::string("Could not open statistics sidecar ") + sidecar);
+   fwrite(SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC), 1, file);
+
+   int frames(0);
+   auto write = [&]() {
+      FrameStats stats;
+      measure(stats);
+      fwrite(&stats, sizeof(stats), 1, file);
+      ++frames;
+   };
+   Packet packet;
+   while (av_read_frame(_fmtCtx.get(), packet.get()) >= 0) {
+      int gotFrame(0);
+      int ret = packet->stream_index == _stream->index
+            ? avcodec_decode_video2(_decCtx, _frame.get(), &gotFrame, packet.get()) : 0;
+      packet.reset();
+      if (ret < 0) {
+         fclose(file);
+         throw std::runtime_error("Error decoding video");
+      }
+      if (gotFrame)
+         write();
+   }
+   // drain the frames the decoder still holds, with the empty packet
+   for (int gotFrame(1); gotFrame; )
+      if (avcodec_decode_video2(_decCtx, _frame.get(), &gotFrame, packet.get()) < 0)
+         break;
+      else if (gotFrame)
+         write();
+
+   if (fclose(file) != 0)
+      throw std::runtime_error(std::string("Could not write statistics sidecar ") + sidecar);
+   return frames;
+}
+
+void Analyzer::measure(FrameStats& stats)
+{
+   if (!_gray) {
+      _grayWidth = std::min(_config.width, _frame->width) & ~1;
+      _grayHeight = (int)((int64_t)_frame->height * _grayWidth / _frame->width) & ~1;
+      _gray.reset(static_cast<uint8_t*>(av_malloc(_grayWidth * _grayHeight)));
+      if (!_gray)
+         throw std::runtime_error("Could not allocate analysis buffer");
+   }
+   _swsCtx.reset(sws_getCachedContext(_swsCtx.release(), _frame->width, _frame->height, _decCtx->pix_fmt,
+                                      _grayWidth, _grayHeight, AV_PIX_FMT_GRAY8,
+                                      SWS_FAST_BILINEAR, NULL, NULL, NULL));
+   if (!_swsCtx)
+      throw std::runtime_error("Could not initialize the analysis conversion context");
+   uint8_t *gray[4] = {_gray.get()};
+   int grayLinesizes[4] = {_grayWidth};
+   sws_scale(_swsCtx.get(), (const uint8_t * const *)_frame->data, _frame->linesize, 0, _frame->height,
+             gray, grayLinesizes);
+
+   uint32_t counts[FrameStats::BINS] = {0};
+   uint64_t sum(0);
+   int pixels = _grayWidth * _grayHeight;
+   for (int i(0); i < pixels; ++i) {
+      sum += gray[0][i];
+      ++counts[gray[0][i] * FrameStats::BINS / 256];
+   }
+
+   int64_t pts = av_frame_get_best_effort_timestamp(_frame.get());
+   int64_t start = _stream->start_time != AV_NOPTS_VALUE ? _stream->start_time : 0;
+   stats.time = pts != AV_NOPTS_VALUE ? (pts - start) * av_q2d(_stream->time_base) : 0.;
+   stats.lumaMean = (float)sum / pixels;
+
+   // a shot starts where the histogram changes by more than the threshold
+   double change(0.);
+   for (int bin(0); bin < FrameStats::BINS; ++bin) {
+      float fraction = (float)counts[bin] / pixels;
+      stats.histogram[bin] = (uint16_t)lrintf(fraction * 65535.f);
+      change += std::fabs(fraction - _lastHistogram[bin]);
+      _lastHistogram[bin] = fraction;
+   }
+   // the first frame differs from the empty histogram by 1
+   stats.sceneCut = change / 2. > _config.cutThreshold;
+}
+
+Statistics::Statistics(const char *sidecar, int deflickerRadius)
+{
+   FILE *file = fopen(sidecar, "rb");
+   if (!file)
+      throw std::runtime_error(std::string("Could not open statistics sidecar ") + sidecar);
+   char magic[sizeof(SIDECAR_MAGIC)];
+   if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, SIDECAR_MAGIC, sizeof(magic))) {
+      fclose(file);
+      throw std::runtime_error(std::string("Not a statistics sidecar: ") + sidecar);
+   }
+   FrameStats stats;
+   while (fread(&stats, sizeof(stats), 1, file) == 1)
+      _frames.push_back(stats);
+   fclose(file);
+   computeDeflicker(deflickerRadius);
+}
+
+size_t Statistics::sceneCuts() const
+{
+   return std::count_if(_frames.begin(), _frames.end(),
+                        [](const FrameStats& stats) { return stats.sceneCut != 0; });
+}
+
+const FrameStats *Statistics::at(double time) const
+{
+   if (_frames.empty())
+      return nullptr;
+   auto next = std::lower_bound(_frames.begin(), _frames.end(), time,
+                                [](const FrameStats& stats, double t) { return stats.time < t; });
+   if (next == _frames.end() || (next != _frames.begin() && time - (next - 1)->time < next->time - time))
+      --next;
+   // the second pass may retime frames (decimate), accept the nearest within a frame
+   double interval = _frames.size() > 1
+         ? (_frames.back().time - _frames.front().time) / (_frames.size() - 1) : 1.;
+   return std::fabs(next->time - time) <= interval ? &*next : nullptr;
+}
+
+double Statistics::deflickerGain(double time) const
+{
+   const FrameStats *stats = at(time);
+   return stats ? _gains[stats - _frames.data()] : 1.;
+}
+
+void Statistics::computeDeflicker(int radius)
+{
+   _gains.assign(_frames.size(), 1.);
+   size_t shot(0);
+   for (size_t i(0); i < _frames.size(); ++i) {
+      if (_frames[i].sceneCut)
+         shot = i;
+      // the window never crosses a cut: a new shot is a real brightness change
+      size_t end(i + 1);
+      while (end < _frames.size() && end <= i + radius && !_frames[end].sceneCut)
+         ++end;
+      size_t begin = std::max(shot, i >= (size_t)radius ? i - radius : 0);
+      double sum(0.);
+      for (size_t j(begin); j < end; ++j)
+         sum += _frames[j].lumaMean;
+      double target = sum / (end - begin);
+      if (_frames[i].lumaMean >= 1.f)
+         _gains[i] = std::max(0.5, std::min(2., target / _frames[i].lumaMean));
+   }
+}
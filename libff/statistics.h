@@ -0,0 +1,79 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include "avptr.h"
+#include "libav.h"
+
+#include <vector>
+
+// One sidecar record, written as is: 80 bytes, no padding.
+struct FrameStats
+{
+   static const int BINS = 32;
+
+   double time;                 // seconds from the start of the input
+   float lumaMean;              // 0..255
+   uint32_t sceneCut;           // first frame of a shot
+   uint16_t histogram[BINS];    // luma histogram, fractions of 65535
+};
+
+struct AnalysisConfig
+{
+   int lowres = 1;              // decoder downscale by 2^lowres where supported
+   int width = 256;             // frames are measured at this width at most
+   double cutThreshold = 0.35;  // histogram change (0..1) that starts a new shot
+};
+
+// First pass: decodes the whole input as cheaply as the decoder allows and
+// writes per-frame luma statistics to a sidecar, so the full quality pass
+// gets global knowledge of the clip without buffering it.
+class Analyzer
+{
+public:
+   Analyzer(const char *src, const AnalysisConfig& config = AnalysisConfig());
+   virtual ~Analyzer();
+   // Returns the number of frames analyzed.
+   int run(const char *sidecar);
+   double duration() const { return _duration; }
+
+private:
+   Analyzer(const Analyzer&);
+   Analyzer& operator=(const Analyzer&);
+   void measure(FrameStats& stats);
+
+   AnalysisConfig _config;
+   InputFormatPtr _fmtCtx;
+   AVCodecContext *_decCtx = nullptr;
+   OpenCodecPtr _decoder;
+   AVStream *_stream = nullptr;
+   FramePtr _frame;
+   SwsContextPtr _swsCtx;
+   AvMallocPtr<uint8_t> _gray;
+   int _grayWidth = 0;
+   int _grayHeight = 0;
+   double _duration = 0.;
+   std::vector<float> _lastHistogram;
+};
+
+// Second pass: the statistics of a sidecar, looked up by frame time.
+class Statistics
+{
+public:
+   // Deflicker targets average radius frames each side.
+   Statistics(const char *sidecar, int deflickerRadius = 12);
+   size_t size() const { return _frames.size(); }
+   size_t sceneCuts() const;
+   // the record closest to time, nullptr when none is within a frame
+   const FrameStats *at(double time) const;
+   // Gain bringing the frame luma to the mean of the frames within radius of
+   // it in the same shot; 1 for unknown frames.
+   double deflickerGain(double time) const;
+
+private:
+   void computeDeflicker(int radius);
+
+   std::vector<FrameStats> _frames;
+   std::vector<double> _gains;
+};
+
+#endif // STATISTICS_H
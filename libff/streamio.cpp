@@ -0,0 +1,119 @@
+#include "streamio.h"
+#include "cancel.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+bool StreamIO::isStream(const char *url)
+{
+   return !strcmp(url, "-") || !strncmp(url, "fd:", 3) || !strncmp(url, "unix:", 5);
+}
+
+StreamIO::StreamIO(const char *url, bool write)
+{
+   if (!strcmp(url, "-"))
+      _fd = write ? STDOUT_FILENO : STDIN_FILENO;
+   else if (!strncmp(url, "fd:", 3))
+      _fd = atoi(url + 3);
+   else if (!strncmp(url, "unix:", 5)) {
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, url + 5, sizeof(addr.sun_path) - 1);
+      _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (_fd < 0 || connect(_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+         if (_fd >= 0)
+            ::close(_fd);
+         throw std::runtime_error(std::string("Could not connect to ") + url);
+      }
+      _ownsFd = true;
+   }
+   else
+      throw std::runtime_error(std::string("Not a stream url: ") + url);
+
+   unsigned char *buffer = static_cast<unsigned char*>(av_malloc(BUFFER_SIZE));
+   if (!buffer)
+      throw std::runtime_error("Could not allocate stream buffer");
+   _avio = avio_alloc_context(buffer, BUFFER_SIZE, write, this,
+                              write ? NULL : &StreamIO::read,
+                              write ? &StreamIO::write : NULL, NULL);
+   if (!_avio) {
+      av_free(buffer);
+      throw std::runtime_error("Could not allocate stream context");
+   }
+   // no seek callback: muxers and demuxers must not rely on seeking back
+   _avio->seekable = 0;
+}
+
+StreamIO::~StreamIO()
+{
+   if (_avio->write_flag)
+      avio_flush(_avio);
+   av_freep(&_avio->buffer);
+   av_freep(&_avio);
+   if (_ownsFd)
+      ::close(_fd);
+}
+
+int StreamIO::wait(short events)
+{
+   if (!_interrupt.callback)
+      return 0;
+   for (;;) {
+      if (_interrupt.callback(_interrupt.opaque))
+         return AVERROR_EXIT;
+      struct pollfd fd = { _fd, events, 0 };
+      int ret = ::poll(&fd, 1, CancelToken::BOUND_MS);
+      if (ret > 0)
+         return 0;
+      if (ret < 0 && errno != EINTR)
+         return AVERROR(errno);
+   }
+}
+
+int StreamIO::read(void *opaque, uint8_t *buf, int size)
+{
+   StreamIO *io = static_cast<StreamIO*>(opaque);
+   for (;;) {
+      int waited = io->wait(POLLIN);
+      if (waited < 0)
+         return waited;
+      ssize_t ret = ::read(io->_fd, buf, size);
+      if (ret > 0) {
+         io->_bytes += ret;
+         return ret;
+      }
+      if (ret == 0)
+         return AVERROR_EOF;
+      if (errno != EINTR)
+         return AVERROR(errno);
+   }
+}
+
+int StreamIO::write(void *opaque, uint8_t *buf, int size)
+{
+   StreamIO *io = static_cast<StreamIO*>(opaque);
+   // pipes and sockets take partial writes
+   for (int done(0); done < size; ) {
+      int waited = io->wait(POLLOUT);
+      if (waited < 0)
+         return waited;
+      ssize_t ret = ::write(io->_fd, buf + done, size - done);
+      if (ret < 0) {
+         if (errno == EINTR)
+            continue;
+         return AVERROR(errno);
+      }
+      done += ret;
+      io->_bytes += ret;
+   }
+   return size;
+}
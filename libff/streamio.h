@@ -0,0 +1,41 @@
+#ifndef STREAMIO_H
+#define STREAMIO_H
+
+#include "libav.h"
+
+// Non seekable AVIOContext over a file descriptor, so tools can be chained
+// in a shell pipeline without intermediate files. Accepted urls:
+//   -                stdin when reading, stdout when writing
+//   fd:N             an inherited pipe or socket descriptor
+//   unix:/path       a connected Unix domain stream socket
+class StreamIO
+{
+public:
+   static bool isStream(const char *url);
+
+   StreamIO(const char *url, bool write);
+   virtual ~StreamIO();
+   AVIOContext *context() { return _avio; }
+   int64_t bytes() const { return _bytes; }
+   // Reads and writes wait for the descriptor in slices of
+   // CancelToken::BOUND_MS and give up with AVERROR_EXIT when this returns
+   // non-zero, so a stalled peer can't block them for good.
+   void setInterruptCallback(const AVIOInterruptCB& callback) { _interrupt = callback; }
+
+private:
+   StreamIO(const StreamIO&);
+   StreamIO& operator=(const StreamIO&);
+   static int read(void *opaque, uint8_t *buf, int size);
+   static int write(void *opaque, uint8_t *buf, int size);
+   int wait(short events);
+
+   const int BUFFER_SIZE = 256 * 1024;
+
+   int _fd = -1;
+   bool _ownsFd = false;
+   AVIOContext *_avio = nullptr;
+   int64_t _bytes = 0;
+   AVIOInterruptCB _interrupt = { NULL, NULL };
+};
+
+#endif // STREAMIO_H
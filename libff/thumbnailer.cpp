@@ -0,0 +1,188 @@
+#include "thumbnailer.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// Input, stream and keyframe-only decoder of one extraction thread.
+struct ThumbnailInput
+{
+   InputFormatPtr fmtCtx;
+   AVCodecContext *decCtx = nullptr;
+   OpenCodecPtr decoder;
+   AVStream *stream = nullptr;
+
+   // concurrent opens are serialized by the lock manager of initLibav
+   ThumbnailInput(const char *filename, int lowres)
+   {
+      AVCodec *dec;
+      AVFormatContext *ctx = NULL;
+      if (avformat_open_input(&ctx, filename, NULL, NULL) < 0)
+         throw std::runtime_error("Cannot open input file\n");
+      fmtCtx.reset(ctx);
+      if (avformat_find_stream_info(ctx, NULL) < 0)
+         throw std::runtime_error("Cannot find stream information\n");
+      int index = av_find_best_stream(ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &dec, 0);
+      if (index < 0)
+         throw std::runtime_error("Cannot find a video stream in the input file");
+      stream = fmtCtx->streams[index];
+      decCtx = stream->codec;
+
+      // only keyframes, as cheaply as the decoder allows; threads are ours
+      decCtx->skip_frame = AVDISCARD_NONKEY;
+      decCtx->skip_loop_filter = AVDISCARD_ALL;
+      decCtx->flags2 |= CODEC_FLAG2_FAST;
+      decCtx->lowres = std::min(lowres, (int)dec->max_lowres);
+      decCtx->thread_count = 1;
+      if (avcodec_open2(decCtx, dec, NULL) < 0)
+         throw std::runtime_error("Cannot open video decoder\n");
+      decoder.reset(decCtx);
+   }
+};
+
+Thumbnailer::Thumbnailer(const char *src, const ThumbnailConfig& config)
+: _filename(src)
+, _config(config)
+{
+   initLibav();
+   probe();
+}
+
+void Thumbnailer::probe()
+{
+   ThumbnailInput input(_filename, 0);
+   if (input.fmtCtx->duration == AV_NOPTS_VALUE)
+      throw std::runtime_error("Input duration is unknown, can't place thumbnails");
+   _duration = (double)input.fmtCtx->duration / AV_TIME_BASE;
+
+   AVRational sar = input.decCtx->sample_aspect_ratio;
+   double aspect = (double)input.decCtx->width / input.decCtx->height;
+   if (sar.num && sar.den)
+      aspect *= av_q2d(sar);
+   _thumbWidth = _config.width & ~1;
+   _thumbHeight = (int)(_thumbWidth / aspect) & ~1;
+
+   int count = std::max(1, (int)(_duration / _config.interval));
+   _thumbnails.resize(count);
+   for (int i(0); i < count; ++i)
+      _thumbnails[i].time = i * _config.interval;
+}
+
+int Thumbnailer::extract(const char *prefix)
+{
+   // contiguous time ranges per thread: seeks within a range move forward
+   size_t threads = std::max(1, std::min<int>(_config.threads, _thumbnails.size()));
+   size_t perThread = (_thumbnails.size() + threads - 1) / threads;
+   std::vector<std::thread> workers;
+   std::vector<std::exception_ptr> errors(threads);
+   for (size_t i(0); i < threads; ++i)
+      workers.push_back(std::thread([this, i, perThread, &errors] {
+         try {
+            extractRange(i * perThread, std::min(_thumbnails.size(), (i + 1) * perThread));
+         }
+         catch (...) {
+            errors[i] = std::current_exception();
+         }
+      }));
+   for (auto worker(workers.begin()); worker != workers.end(); ++worker)
+      worker->join();
+   for (auto error(errors.begin()); error != errors.end(); ++error)
+      if (*error)
+         std::rethrow_exception(*error);
+
+   if (_config.columns > 0)
+      writeSheet(prefix);
+   else
+      writeImages(prefix);
+   return std::count_if(_thumbnails.begin(), _thumbnails.end(),
+                        [](const Thumbnail& thumb) { return thumb.valid; });
+}
+
+void Thumbnailer::extractRange(size_t first, size_t last)
+{
+   if (first >= last)
+      return;
+   ThumbnailInput input(_filename, _config.lowres);
+   FramePtr frame = allocFrame();
+   SwsContextPtr swsCtx;
+   Packet packet;
+   int rgbLinesize = 3 * _thumbWidth;
+   int64_t start = input.stream->start_time != AV_NOPTS_VALUE ? input.stream->start_time : 0;
+
+   for (size_t i(first); i < last; ++i) {
+      Thumbnail& thumb = _thumbnails[i];
+      int64_t ts = start + av_rescale_q((int64_t)(thumb.time * AV_TIME_BASE), AV_TIME_BASE_Q,
+                                        input.stream->time_base);
+      // the keyframe at or before the thumbnail time
+      if (av_seek_frame(input.fmtCtx.get(), input.stream->index, ts, AVSEEK_FLAG_BACKWARD) < 0)
+         continue;
+      avcodec_flush_buffers(input.decCtx);
+
+      int gotFrame(0);
+      while (!gotFrame && av_read_frame(input.fmtCtx.get(), packet.get()) >= 0) {
+         // non-key packets are parsed but not decoded
+         if (packet->stream_index == input.stream->index
+             && avcodec_decode_video2(input.decCtx, frame.get(), &gotFrame, packet.get()) < 0)
+            gotFrame = 0;
+         packet.reset();
+      }
+      if (!gotFrame)
+         continue;
+
+      swsCtx.reset(sws_getCachedContext(swsCtx.release(), frame->width, frame->height,
+                                        input.decCtx->pix_fmt, _thumbWidth, _thumbHeight, AV_PIX_FMT_RGB24,
+                                        SWS_FAST_BILINEAR, NULL, NULL, NULL));
+      if (!swsCtx)
+         continue;
+      thumb.rgb.resize(rgbLinesize * _thumbHeight);
+      uint8_t *rgb[4] = {thumb.rgb.data()};
+      int rgbLinesizes[4] = {rgbLinesize};
+      sws_scale(swsCtx.get(), (const uint8_t * const *)frame->data, frame->linesize, 0, frame->height,
+                rgb, rgbLinesizes);
+      thumb.valid = true;
+   }
+}
+
+static void writePpm(const char *filename, const uint8_t *rgb, int width, int height)
+{
+   FILE *file = fopen(filename, "wb");
+   if (!file)
+      throw std::runtime_error(std::string("Could not open thumbnail file ") + filename);
+   fprintf(file, "P6\n%d %d\n255\n", width, height);
+   fwrite(rgb, 3, (size_t)width * height, file);
+   fclose(file);
+}
+
+void Thumbnailer::writeImages(const char *prefix) const
+{
+   char filename[1024];
+   for (size_t i(0); i < _thumbnails.size(); ++i) {
+      if (!_thumbnails[i].valid)
+         continue;
+      snprintf(filename, sizeof(filename), "%s%05d.ppm", prefix, (int)i);
+      writePpm(filename, _thumbnails[i].rgb.data(), _thumbWidth, _thumbHeight);
+   }
+}
+
+void Thumbnailer::writeSheet(const char *prefix) const
+{
+   int columns = _config.columns;
+   int rows = (_thumbnails.size() + columns - 1) / columns;
+   int sheetWidth = columns * _thumbWidth;
+   int rowBytes = 3 * _thumbWidth;
+   // missing thumbnails stay black
+   std::vector<uint8_t> sheet((size_t)3 * sheetWidth * rows * _thumbHeight, 0);
+   for (size_t i(0); i < _thumbnails.size(); ++i) {
+      if (!_thumbnails[i].valid)
+         continue;
+      uint8_t *origin = sheet.data() + ((i / columns) * _thumbHeight * sheetWidth + (i % columns) * _thumbWidth) * 3;
+      for (int y(0); y < _thumbHeight; ++y)
+         std::copy(_thumbnails[i].rgb.begin() + y * rowBytes, _thumbnails[i].rgb.begin() + (y + 1) * rowBytes,
+                   origin + (size_t)y * sheetWidth * 3);
+   }
+   std::string filename = std::string(prefix) + "sheet.ppm";
+   writePpm(filename.c_str(), sheet.data(), sheetWidth, rows * _thumbHeight);
+}
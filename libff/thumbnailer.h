@@ -0,0 +1,52 @@
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include "avptr.h"
+#include "libav.h"
+
+#include <vector>
+
+struct ThumbnailConfig
+{
+   double interval = 10.; // seconds between thumbnails
+   int width = 320;       // thumbnail width, the height keeps the aspect ratio
+   int lowres = 1;        // decoder downscale by 2^lowres where the decoder supports it
+   int threads = 4;       // keyframe ranges extracted in parallel
+   int columns = 0;       // > 0: one contact sheet this many thumbnails wide
+};
+
+// Browse thumbnails from keyframes only. The decoder skips every non-key
+// frame (skip_frame) and decodes at reduced resolution (lowres); each
+// thumbnail seeks to the keyframe at or before its time, so a multi-hour
+// file costs a few hundred keyframe decodes instead of a full decode.
+class Thumbnailer
+{
+public:
+   Thumbnailer(const char *src, const ThumbnailConfig& config = ThumbnailConfig());
+   // Writes <prefix>NNNNN.ppm per thumbnail, or <prefix>sheet.ppm, and
+   // returns the number of thumbnails.
+   int extract(const char *prefix);
+   double duration() const { return _duration; }
+
+private:
+   struct Thumbnail
+   {
+      double time = 0.;
+      bool valid = false;
+      std::vector<uint8_t> rgb;
+   };
+
+   void probe();
+   void extractRange(size_t first, size_t last);
+   void writeImages(const char *prefix) const;
+   void writeSheet(const char *prefix) const;
+
+   const char *_filename;
+   ThumbnailConfig _config;
+   double _duration = 0.;
+   int _thumbWidth = 0;
+   int _thumbHeight = 0;
+   std::vector<Thumbnail> _thumbnails;
+};
+
+#endif // THUMBNAILER_H
@@ -0,0 +1,164 @@
+#include "trace.h"
+#include "allocations.h"
+
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+struct Event
+{
+   const char *name;
+   int64_t pts;
+   Clock::time_point begin;
+   Clock::time_point end;
+};
+
+struct Block
+{
+   Event events[Trace::BLOCK_EVENTS];
+   int size = 0;
+};
+
+struct ThreadBuffer
+{
+   long tid;
+   std::string name;
+   // oldest first, the last one is being filled
+   std::deque<std::unique_ptr<Block>> blocks;
+   int64_t dropped = 0;
+
+   void add(const Event& event)
+   {
+      if (blocks.empty() || blocks.back()->size == Trace::BLOCK_EVENTS)
+         nextBlock();
+      Block& block = *blocks.back();
+      block.events[block.size++] = event;
+   }
+
+   void nextBlock()
+   {
+      std::unique_ptr<Block> block;
+      if ((int)blocks.size() * Trace::BLOCK_EVENTS >= Trace::MAX_EVENTS) {
+         block = std::move(blocks.front());
+         blocks.pop_front();
+         dropped += block->size;
+         block->size = 0;
+      }
+      else {
+         // tracing memory is not the pipeline's
+         Allocations::Scope pause(false);
+         block.reset(new Block);
+      }
+      blocks.push_back(std::move(block));
+   }
+};
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+Clock::time_point origin;
+thread_local ThreadBuffer *threadBuffer = nullptr;
+
+ThreadBuffer& buffer()
+{
+   if (!threadBuffer) {
+      // once per thread: the only time a thread takes the lock
+      std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+      buffer->tid = syscall(SYS_gettid);
+      buffer->nextBlock();
+      threadBuffer = buffer.get();
+      std::lock_guard<std::mutex> lock(registryMutex);
+      registry.push_back(std::move(buffer));
+   }
+   return *threadBuffer;
+}
+
+}
+
+std::atomic<bool> Trace::_enabled(false);
+
+void Trace::start()
+{
+   origin = Clock::now();
+   _enabled = true;
+}
+
+void Trace::setThreadName(const std::string& name)
+{
+   if (enabled())
+      buffer().name = name;
+}
+
+void Trace::record(const char *name, int64_t pts, Clock::time_point begin, Clock::time_point end)
+{
+   Event event = {name, pts, begin, end};
+   buffer().add(event);
+}
+
+// JSON string body: quotes, backslashes and control characters escaped
+static void writeEscaped(FILE *file, const char *text)
+{
+   for (const char *c(text); *c; ++c) {
+      if (*c == '"' || *c == '\\')
+         fprintf(file, "\\%c", *c);
+      else if ((unsigned char)*c < 0x20)
+         fprintf(file, "\\u%04x", (unsigned char)*c);
+      else
+         fputc(*c, file);
+   }
+}
+
+static double micros(Clock::time_point time)
+{
+   return std::chrono::duration<double, std::micro>(time - origin).count();
+}
+
+void Trace::write(const char *filename)
+{
+   _enabled = false;
+   FILE *file = fopen(filename, "w");
+   if (!file)
+      throw std::runtime_error(std::string("Could not open trace file ") + filename);
+
+   int pid = getpid();
+   std::lock_guard<std::mutex> lock(registryMutex);
+   fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+   const char *separator = "";
+   for (auto thread(registry.begin()); thread != registry.end(); ++thread) {
+      const ThreadBuffer& buffer = **thread;
+      if (!buffer.name.empty() || buffer.dropped) {
+         fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"",
+                 separator, pid, buffer.tid);
+         writeEscaped(file, buffer.name.c_str());
+         fprintf(file, "\",\"dropped_events\":%lld}}", (long long)buffer.dropped);
+         separator = ",\n";
+      }
+      if (buffer.dropped)
+         std::cerr <<"trace: dropped the first " <<buffer.dropped <<" events of thread " <<buffer.tid
+                   <<(buffer.name.empty() ? "" : " ") <<buffer.name <<std::endl;
+      for (auto block(buffer.blocks.begin()); block != buffer.blocks.end(); ++block) {
+         for (const Event *event((*block)->events); event != (*block)->events + (*block)->size; ++event) {
+            fprintf(file, "%s{\"ph\":\"X\",\"cat\":\"frame\",\"name\":\"", separator);
+            writeEscaped(file, event->name);
+            fprintf(file, "\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f",
+                    pid, buffer.tid, micros(event->begin),
+                    std::chrono::duration<double, std::micro>(event->end - event->begin).count());
+            if (event->pts != NO_PTS)
+               fprintf(file, ",\"args\":{\"pts\":%lld}", (long long)event->pts);
+            fprintf(file, "}");
+            separator = ",\n";
+         }
+      }
+   }
+   fprintf(file, "\n]}\n");
+   if (fclose(file) != 0)
+      throw std::runtime_error(std::string("Could not write trace file ") + filename);
+}
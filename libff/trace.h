@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "latency.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Per-frame timeline in the Chrome trace event format, for chrome://tracing
+// and ui.perfetto.dev. Every thread appends complete events to its own
+// buffer without locking; the buffers are merged when the trace is written.
+// A buffer is a ring of fixed blocks: it never moves the events it holds,
+// and once full it drops the oldest block, so a long run keeps its last
+// MAX_EVENTS events per thread and the trace says how many were dropped.
+class Trace
+{
+public:
+   static const int64_t NO_PTS = INT64_MIN;
+   static const int BLOCK_EVENTS = 4096;
+   static const int MAX_EVENTS = 256 * BLOCK_EVENTS;
+
+   static void start();
+   static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+   // Name of the calling thread in the viewer.
+   static void setThreadName(const std::string& name);
+   // Stops recording and writes the trace. Call it once every traced thread
+   // has finished its work.
+   static void write(const char *filename);
+
+   // name must be a string literal, only the pointer is kept
+   static void record(const char *name, int64_t pts, Clock::time_point begin, Clock::time_point end);
+
+private:
+   static std::atomic<bool> _enabled;
+};
+
+// Records the time from its construction to its destruction as a span of
+// the calling thread, tagged with the pts of the frame being worked on.
+class TraceSpan
+{
+public:
+   TraceSpan(const char *name, int64_t pts = Trace::NO_PTS)
+   : _name(Trace::enabled() ? name : nullptr)
+   , _pts(pts)
+   {
+      if (_name)
+         _begin = Clock::now();
+   }
+   ~TraceSpan()
+   {
+      if (_name)
+         Trace::record(_name, _pts, _begin, Clock::now());
+   }
+   // for spans that only learn the pts of their frame at the end, e.g. decode
+   void setPts(int64_t pts) { _pts = pts; }
+
+private:
+   TraceSpan(const TraceSpan&);
+   TraceSpan& operator=(const TraceSpan&);
+   const char *_name;
+   int64_t _pts;
+   Clock::time_point _begin;
+};
+
+#endif // TRACE_H
@@ -193,7 +193,7 @@ void write_video_frame(AVFormatContext *oc, AVStream *st)
       
       pkt.flags        |= AV_PKT_FLAG_KEY;
       pkt.stream_index  = st->index;
-      pkt.data          = dst_picture.data[0];
+      pkt.data          = (uint8_t *)&dst_picture;
       pkt.size          = sizeof(AVPicture);
       
       ret = av_interleaved_write_frame(oc, &pkt);
@@ -263,6 +263,7 @@ try
              "muxes them into a file named output_file.\n"
              "The output format is automatically guessed according to the file extension.\n"
              "Raw images can also be output by using '%%d' in the filename.\n"
+             "Use - to stream a fragmented mov to stdout.\n"
              "\n", argv[0]);
       return 1;
    }
@@ -270,7 +271,16 @@ try
    filename = argv[1];
    
    // allocate the output media context 
-   avformat_alloc_output_context2(&oc, NULL, NULL, filename);
+   AVDictionary *options = NULL;
+   if (!strcmp(filename, "-")) {
+      // stdout can't seek back to write the moov: write a fragmented mov
+      // through the pipe protocol instead
+      filename = "pipe:1";
+      avformat_alloc_output_context2(&oc, NULL, "mov", filename);
+      av_dict_set(&options, "movflags", "empty_moov+frag_keyframe", 0);
+   }
+   else
+      avformat_alloc_output_context2(&oc, NULL, NULL, filename);
    if (!oc) {
       std::cout <<"Could not deduce output format from file extension: using MPEG" <<std::endl;
       avformat_alloc_output_context2(&oc, NULL, "mpeg", filename);
@@ -304,7 +314,9 @@ try
    }
    
    // Write the stream header, if any. 
-   if (avformat_write_header(oc, NULL) < 0) 
+   ret = avformat_write_header(oc, &options);
+   av_dict_free(&options);
+   if (ret < 0) 
       throw std::runtime_error("Error occurred when opening output file");
    
    if (frame)
@@ -1,5 +0,0 @@
-#include "image.h"
-
-//Image::Image()
-//{
-//}
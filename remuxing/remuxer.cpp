@@ -1,35 +1,761 @@
+#include "cancel.h"
+#include "checkpoint.h"
 #include "filter.h"
 #include "demuxer.h"
+#include "duplicates.h"
+#include "fanout.h"
+#include "framesource.h"
 #include "muxer.h"
+#include "placement.h"
+#include "statistics.h"
 
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace std;
 
+static void scaleRgb444(uint8_t *const *rows, const int *linesizes, int width, int height,
+                        const uint16_t *lut)
+{
+   for (int y(0); y < height; ++y) {
+      uint16_t *pixel = reinterpret_cast<uint16_t*>(rows[0] + y * linesizes[0]);
+      for (int x(0); x < width; ++x, ++pixel)
+         *pixel = (*pixel & 0xf000) | lut[(*pixel >> 8) & 0xf] << 8
+                  | lut[(*pixel >> 4) & 0xf] << 4 | lut[*pixel & 0xf];
+   }
+}
+
+static void gainLut(double gain, uint16_t *lut)
+{
+   for (int v(0); v < 16; ++v)
+      lut[v] = std::min(15, (int)lrint(v * gain));
+}
+
+// Scales the 4 bit components of packed RGB444 pixels by a constant gain.
+static BandPass::Stage rgb444Gain(double gain)
+{
+   std::vector<uint16_t> lut(16);
+   gainLut(gain, lut.data());
+   return [lut](uint8_t *const *rows, const int *linesizes, int width, int, int height, double) {
+      scaleRgb444(rows, linesizes, width, height, lut.data());
+   };
+}
+
+// Evens out the frame to frame brightness of each shot, with the gains of
+// the analysis pass sidecar.
+static BandPass::Stage rgb444Deflicker(std::shared_ptr<const Statistics> statistics)
+{
+   return [statistics](uint8_t *const *rows, const int *linesizes, int width, int, int height,
+                       double time) {
+      uint16_t lut[16];
+      gainLut(statistics->deflickerGain(time), lut);
+      scaleRgb444(rows, linesizes, width, height, lut);
+   };
+}
+
+static void usage(const char *name)
+{
+   cerr <<"usage: " <<name <<" -analyze stats_sidecar input_file" <<std::endl
+        <<"       " <<name <<" [-vf filters] [-an] [-vcodec codec[/pix_fmt]] [-unfused] [-gain g] [-deflicker stats_sidecar] [-shm ring_name]"
+        <<" [-dedup threshold] [-pages normal|thp|huge [-node n]] [-place stage=cpus[:...]]"
+        <<" [-perf] [-allocs] [-crc sidecar_prefix] [-quality every_n [-qualitycsv file.csv]] [-trace trace.json] [-repeat n [-rssgrowth kB]] [-fragment ms [-flush ms]]"
+        <<" [-live [-drop ms]] [-timeout s] [-iotimeout ms] [-checkpoint ms [-resume]]"
+        <<" [-rendition file:codec:WxH:bitrate]..."
+        <<" input_file video_output_file" <<std::endl
+        <<"       " <<name <<" [the options above] -serve socket_path" <<std::endl
+        <<"a daemon job is a line: input_file video_output_file [-vf filters] [-an] [file:codec:WxH:bitrate]..."
+        <<std::endl
+        <<"input and output can be - (stdin/stdout), fd:N or unix:/socket/path" <<std::endl
+        <<"codec is an encoder with an optional pixel format, e.g. v210 or rawvideo/uyvy422 (uncompressed)"
+        <<std::endl
+        <<"-resume takes the outputs up at their file.checkpoint, with the options they were started with"
+        <<std::endl
+        <<"-allocs fails when the master rendition allocates heap memory per frame once warmed up; audio"
+        <<" interleaving and encoders other than DNxHD do, run it with -an and the default codec" <<std::endl;
+   exit(1);
+}
+
+struct Rendition
+{
+   std::string filename;
+   MuxerConfig config;
+};
+
+// Parses encoder[/pix_fmt], e.g. v210 or rawvideo/uyvy422. Uncompressed
+// output defaults to 8 bit 4:2:2 UYVY, the 2vuy of mov.
+static void parseCodec(const std::string& spec, MuxerConfig& config)
+{
+   initLibav();
+   size_t fmtPos = spec.find('/');
+   std::string codecName = spec.substr(0, fmtPos);
+   AVCodec *codec = avcodec_find_encoder_by_name(codecName.c_str());
+   if (!codec)
+      throw std::runtime_error("Unknown encoder " + codecName);
+   config.codec = codec->id;
+   if (fmtPos != std::string::npos) {
+      config.pixFmt = av_get_pix_fmt(spec.c_str() + fmtPos + 1);
+      if (config.pixFmt == AV_PIX_FMT_NONE)
+         throw std::runtime_error("Unknown pixel format " + spec.substr(fmtPos + 1));
+   }
+   else if (config.codec == AV_CODEC_ID_RAWVIDEO)
+      config.pixFmt = AV_PIX_FMT_UYVY422;
+}
+
+// Parses file:codec:WxH:bitrate, e.g. proxy.mov:mpeg4:960x540:8000000, with
+// codec as for parseCodec
+static Rendition parseRendition(const std::string& spec)
+{
+   Rendition rendition;
+   size_t codecPos = spec.find(':');
+   size_t sizePos = spec.find(':', codecPos + 1);
+   size_t ratePos = spec.find(':', sizePos + 1);
+   if (ratePos == std::string::npos)
+      throw std::runtime_error("Rendition must be file:codec:WxH:bitrate: " + spec);
+   rendition.filename = spec.substr(0, codecPos);
+   parseCodec(spec.substr(codecPos + 1, sizePos - codecPos - 1), rendition.config);
+
+   if (sscanf(spec.c_str() + sizePos + 1, "%dx%d", &rendition.config.width, &rendition.config.height) != 2)
+      throw std::runtime_error("Rendition size must be WxH: " + spec);
+   rendition.config.bitRate = atoi(spec.c_str() + ratePos + 1);
+   return rendition;
+}
+
+// Everything but the input and the renditions, from the command line.
+struct Options
+{
+   std::string filters;
+   // carry the audio streams into the master rendition
+   bool audio = true;
+   bool fused = true;
+   double gain = 1.0;
+   // shm ring of the filtered frames; a daemon job's name ends in .job_id
+   std::string ringName;
+   int fragmentDuration = 0;
+   int flushInterval = 0;
+   bool live = false;
+   int dropLate = 0;
+   const char *deflickerSidecar = nullptr;
+   double dedupThreshold = -1.;
+   bool pages = false;
+   FrameAllocatorConfig allocatorConfig;
+   bool perf = false;
+   // heap allocations of steady-state encoding in the master rendition, the
+   // process fails when there are any
+   bool allocations = false;
+   // PSNR and SSIM of the master encoder output
+   QualityConfig quality;
+   // checksum sidecars: prefix.filter.crc and prefix.N.crc for rendition N
+   const char *checksums = nullptr;
+   // stops the job, a token of its own when not set
+   std::shared_ptr<CancelToken> cancel;
+   // s a job may run, 0 for no limit
+   double timeout = 0.;
+   // ms any one read, open or write may block, 0 for no limit
+   int ioTimeout = 0;
+   // ms of output between checkpoints, saved next to each rendition as
+   // file.checkpoint; 0 for none
+   int checkpointInterval = 0;
+   // take the renditions up at their checkpoints
+   bool resume = false;
+   // warm state shared by the jobs of a long-running process
+   std::shared_ptr<EncoderPool> encoders;
+   std::shared_ptr<GraphPool> graphs;
+};
+
+struct JobResult
+{
+   int frames = 0;
+   double seconds = 0.;
+   // from the start of the job to the first filtered frame, setup included
+   double firstFrameSeconds = 0.;
+   // with Options::allocations
+   int64_t steadyAllocations = 0;
+};
+
+// Resident set size of this process, from /proc/self/statm.
+static int64_t residentBytes()
+{
+   long pages(0), resident(0);
+   FILE *statm = fopen("/proc/self/statm", "r");
+   if (!statm)
+      return 0;
+   if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+   fclose(statm);
+   return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+// One complete job: every library object it creates is released when it
+// returns, so a process can run any number of them.
+static JobResult remux(const char *src, std::vector<Rendition> renditions, Options options,
+                       const Placement& placement)
+{
+   auto jobStart = chrono::steady_clock::now();
+   if (!options.cancel)
+      options.cancel.reset(new CancelToken);
+   if (options.timeout > 0.)
+      options.cancel->setDeadline(jobStart + chrono::duration_cast<Clock::duration>(
+                                     chrono::duration<double>(options.timeout)));
+   std::shared_ptr<const Statistics> statistics;
+   if (options.deflickerSidecar)
+      statistics.reset(new Statistics(options.deflickerSidecar));
+
+   FilterConfig filterConfig;
+   filterConfig.lowDelay = options.live;
+   filterConfig.filters = options.filters;
+   filterConfig.graphs = options.graphs;
+   filterConfig.audio = options.audio;
+   filterConfig.cancel = options.cancel;
+   filterConfig.ioTimeout = options.ioTimeout;
+   if (options.checksums)
+      filterConfig.checksums = std::string(options.checksums) + ".filter.crc";
+   Filter filter(src, filterConfig);
+   if (options.perf)
+      filter.enablePerfCounters();
+
+   // Resumed, every rendition takes up its output at its own checkpoint and
+   // the filter restarts early enough for the one that got least far.
+   std::vector<std::shared_ptr<const Checkpoint>> checkpoints;
+   int64_t resumeFrame(0);
+   if (options.resume) {
+      for (auto rendition(renditions.begin()); rendition != renditions.end(); ++rendition)
+         checkpoints.push_back(std::make_shared<const Checkpoint>(
+                                  Checkpoint::load(rendition->filename + ".checkpoint")));
+      auto first = std::min_element(checkpoints.begin(), checkpoints.end(),
+                                    [](const std::shared_ptr<const Checkpoint>& a,
+                                       const std::shared_ptr<const Checkpoint>& b) {
+                                       return a->inputFrame < b->inputFrame;
+                                    });
+      resumeFrame = (*first)->inputFrame;
+      filter.resumeFrom(resumeFrame, (*first)->inputPts);
+   }
+   // live: one frame at a time and no queued batches between decode and encode
+   FanOut fanOut(options.live ? 1 : 2);
+
+   // local QC tools map the filtered frames from /dev/shm instead of reading files
+   std::unique_ptr<ShmRingWriter> ring;
+   if (!options.ringName.empty()) {
+      ring.reset(new ShmRingWriter(options.ringName.c_str(), 16,
+                                   avpicture_get_size(filter.pixelFormat(), filter.width(), filter.height()),
+                                   filter.width(), filter.height(), filter.pixelFormat()));
+      filter.setFrameRing(ring.get());
+   }
+
+   // freeze frames and slates repeat the packet of the first frame of the run
+   std::unique_ptr<DuplicateDetector> duplicates;
+   if (options.dedupThreshold >= 0.)
+      duplicates.reset(new DuplicateDetector(filter.pixelFormat(), options.dedupThreshold));
+
+   // Fused: the muxers read the filter buffers directly and copy, process
+   // and convert them band by band. Unfused: every step is a full frame pass.
+   filter.setBorrowFrames(options.fused);
+   // copied frames and the encoder input pictures on huge pages of one node
+   std::shared_ptr<FrameAllocator> allocator;
+   if (options.pages) {
+      if (options.allocatorConfig.node < 0)
+         options.allocatorConfig.node = placement.frameNode();
+      allocator.reset(new FrameAllocator(options.allocatorConfig));
+      filter.setFrameAllocator(allocator);
+   }
+   for (auto rendition(renditions.begin()); rendition != renditions.end(); ++rendition) {
+      rendition->config.fragmentDuration = options.fragmentDuration;
+      rendition->config.flushInterval = options.flushInterval;
+      rendition->config.lowDelay = options.live;
+      rendition->config.dropLate = options.dropLate;
+      rendition->config.allocator = allocator;
+      rendition->config.encoders = options.encoders;
+      rendition->config.cancel = options.cancel;
+      rendition->config.ioTimeout = options.ioTimeout;
+      if (options.checkpointInterval > 0) {
+         rendition->config.checkpointInterval = options.checkpointInterval;
+         rendition->config.checkpoint = rendition->filename + ".checkpoint";
+      }
+      if (!checkpoints.empty())
+         rendition->config.resume = checkpoints[rendition - renditions.begin()];
+      if (options.checksums)
+         rendition->config.checksums = std::string(options.checksums) + "."
+                                     + std::to_string(rendition - renditions.begin()) + ".crc";
+      AVRational frameRate = filter.frameRate();
+      if (frameRate.num > 0 && frameRate.den > 0)
+         rendition->config.frameRate = frameRate;
+      // the proxies stay picture only
+      if (rendition == renditions.begin()) {
+         rendition->config.audioStreams = filter.audioStreams();
+         rendition->config.quality = options.quality;
+      }
+      // the encoder threads and the rendition thread inherit the encode CPUs
+      Placement::Scope encode(placement, Placement::ENCODE);
+      std::unique_ptr<Muxer> muxer(new Muxer(rendition->filename.c_str(), rendition->config));
+      if (!options.fused)
+         muxer->setBandBytes(0);
+      if (options.perf)
+         muxer->enablePerfCounters();
+      if (options.allocations && rendition == renditions.begin())
+         muxer->enableAllocationCount();
+      if (options.gain != 1.0)
+         muxer->addPixelStage(rgb444Gain(options.gain));
+      if (statistics)
+         muxer->addPixelStage(rgb444Deflicker(statistics));
+      fanOut.addMuxer(std::move(muxer));
+   }
+
+   auto start = chrono::steady_clock::now();
+   // live: one frame at a time, the encoders never wait for a batch to fill
+   BatchSource batches = window(frames(filter), options.live ? 1 : 10);
+   JobResult result;
+   int frames(0);
+   for(;;)
+   {
+      Images images = batches();
+      if(images.empty()) break;
+      if (!frames)
+         result.firstFrameSeconds = chrono::duration<double>(chrono::steady_clock::now() - jobStart).count();
+
+      if (duplicates)
+         for (auto image(images.begin()); image != images.end(); ++image)
+            duplicates->check(*image);
+      // deflicker runs per frame inside the muxer band pass, from the
+      // statistics of the analysis pass instead of a window of images here
+      fanOut.write(images, filter.takeAudioPackets());
+      frames += images.size();
+   }
+   // the audio read while the decoder and the graph drained
+   fanOut.write(Images(), filter.takeAudioPackets());
+   // the outputs are complete, trailers and last fragments included, before
+   // the time is taken and the latencies are reported
+   fanOut.finish();
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+   // keep stdout clean when the output is streamed to it
+   bool toStdout(false);
+   for (auto rendition(renditions.begin()); rendition != renditions.end(); ++rendition)
+      toStdout |= rendition->filename == "-";
+   ostream& report = toStdout ? cerr : cout;
+   double mb = 1024. * 1024.;
+   report <<frames <<" frames in " <<seconds <<" s (" <<frames / seconds <<" fps)"
+          <<" to " <<fanOut.size() <<" rendition(s), first frame after "
+          <<1000. * result.firstFrameSeconds <<" ms" <<endl;
+   if (!checkpoints.empty())
+      report <<"resumed at input frame " <<resumeFrame <<", " <<renditions[0].filename
+             <<" at frame " <<checkpoints[0]->frames <<endl;
+   if (!filter.audioStreams().empty())
+      report <<filter.audioStreams().size() <<" audio stream(s) copied into " <<renditions[0].filename <<endl;
+   report <<"filter graph \"" <<filter.filters() <<"\": " <<1000. * filter.graphSetupSeconds() <<" ms setup, "
+          <<(filter.graphPrebuilt() ? "prebuilt" : "built for this input");
+   if (options.graphs)
+      report <<" (" <<options.graphs->hits() <<" prebuilt, " <<options.graphs->misses() <<" built on demand, "
+             <<options.graphs->evictions() <<" idle spares dropped so far)";
+   report <<endl;
+   report <<"read " <<filter.bytesRead() / mb / seconds <<" MB/s, wrote "
+          <<fanOut.muxer(0).bytesWritten() / mb / seconds <<" MB/s" <<endl;
+   if (const BandPass *pass = fanOut.muxer(0).bandPass()) {
+      double copied = frames ? filter.bytesCopied() / frames : 0;
+      report <<"modelled memory traffic per frame: " <<(pass->bytesPerFrame() + copied) / mb <<" MB"
+             <<" (as separate passes: " <<pass->unfusedBytesPerFrame() / mb <<" MB)"
+             <<", band height " <<pass->bandHeight() <<endl;
+      int64_t missBytes = fanOut.muxer(0).convertMissBytes();
+      if (missBytes >= 0 && pass->frames())
+         report <<"measured conversion traffic per frame: " <<missBytes / pass->frames() / mb
+                <<" MB from LLC misses, modelled " <<pass->bytesPerFrame() / mb <<" MB" <<endl;
+   }
+   Muxer& master = fanOut.muxer(0);
+   if (master.encodedFrames())
+      report <<"conversion " <<1000. * master.convertSeconds() / master.encodedFrames() <<" ms/frame, encoding "
+             <<1000. * master.encodeSeconds() / master.encodedFrames() <<" ms/frame, "
+             <<master.packetAllocations() <<" packet buffers allocated beyond the pool" <<endl;
+   if (options.allocations) {
+      report <<master.steadyAllocations() <<" heap allocations in " <<master.steadyFrames()
+             <<" steady-state frames of encoding and writing" <<endl;
+      result.steadyAllocations = master.steadyAllocations();
+   }
+   if (QualityMonitor *quality = master.quality()) {
+      quality->drain();
+      quality->report(report, "encoder output");
+   }
+   if (options.perf) {
+      filter.perfStats()->report(report, frames);
+      master.perfStats()->report(report, master.encodedFrames());
+   }
+   if (allocator)
+      report <<allocator->mappings() <<" frame buffers, " <<allocator->bytesMapped() / mb <<" MB mapped on node "
+             <<allocator->node() <<", " <<allocator->hugePageFallbacks() <<" explicit huge page fallbacks" <<endl;
+   if (duplicates)
+      report <<duplicates->duplicates() <<" duplicate frames, " <<fanOut.muxer(0).repeatedFrames()
+             <<" repeated without encoding, saving " <<fanOut.muxer(0).savedEncodeSeconds() <<" s of "
+             <<fanOut.muxer(0).convertSeconds() + fanOut.muxer(0).encodeSeconds()
+               + fanOut.muxer(0).savedEncodeSeconds()
+             <<" s conversion and encoding" <<endl;
+   if (fanOut.muxer(0).diskLatency().count())
+      fanOut.muxer(0).diskLatency().report(report, "frame-in to disk");
+   if (options.live) {
+      fanOut.muxer(0).muxLatency().report(report, "input to mux");
+      report <<fanOut.muxer(0).droppedFrames() <<" frames dropped behind real time" <<endl;
+   }
+   result.frames = frames;
+   result.seconds = seconds;
+   return result;
+}
+
+// numbers the daemon jobs of all connections
+static std::atomic<int> nextJob(0);
+
+// The open connections of a daemon, so that stopping it can end them.
+struct Connections
+{
+   std::mutex mutex;
+   std::condition_variable cond;
+   std::set<int> clients;
+
+   // while client is still open: its number can't be reused yet
+   void leave(int client)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      clients.erase(client);
+      cond.notify_all();
+   }
+};
+
+// Runs the jobs of one daemon connection, one per line, in order.
+static void serveClient(int client, const Options& options, const Placement& placement,
+                        Connections& connections)
+{
+   placement.pin(Placement::DECODE);
+   // separate streams: a stdio stream can't switch from reading to writing on a socket
+   FILE *in = fdopen(client, "r");
+   FILE *out = fdopen(dup(client), "w");
+   if (!in || !out) {
+      connections.leave(client);
+      if (in)
+         fclose(in);
+      else
+         ::close(client);
+      return;
+   }
+   char *line(nullptr);
+   size_t size(0);
+   while (getline(&line, &size, in) > 0) {
+      std::istringstream words(line);
+      std::string input, output, spec;
+      std::ostringstream reply;
+      try {
+         if (!(words >>input >>output))
+            throw std::runtime_error("A job is: input_file video_output_file [-vf filters] [-an]"
+                                     " [file:codec:WxH:bitrate]...");
+         Options jobOptions(options);
+         // a timeout stops this job only, stopping the daemon stops them all
+         jobOptions.cancel.reset(new CancelToken(options.cancel));
+         // concurrent jobs can't share a ring
+         if (!jobOptions.ringName.empty()) {
+            jobOptions.ringName += "." + std::to_string(++nextJob);
+            cerr <<input <<": frames on shm ring " <<jobOptions.ringName <<endl;
+         }
+         std::vector<Rendition> renditions(1);
+         renditions[0].filename = output;
+         while (words >>spec) {
+            if (spec == "-vf")
+               words >>jobOptions.filters;
+            else if (spec == "-an")
+               jobOptions.audio = false;
+            else
+               renditions.push_back(parseRendition(spec));
+         }
+         JobResult result = remux(input.c_str(), renditions, jobOptions, placement);
+         reply <<"ok " <<result.frames <<" " <<result.seconds <<" " <<1000. * result.firstFrameSeconds;
+      }
+      catch (std::exception& e) {
+         std::string message(e.what());
+         message.erase(message.find_last_not_of("\n") + 1);
+         reply <<"error " <<message;
+      }
+      fprintf(out, "%s\n", reply.str().c_str());
+      fflush(out);
+   }
+   free(line);
+   connections.leave(client);
+   fclose(out);
+   fclose(in);
+}
+
+// Daemon: accepts jobs on a Unix stream socket, one per line,
+//    input_file video_output_file [-vf filters] [-an] [file:codec:WxH:bitrate]...
+// and answers each with "ok frames seconds first_frame_ms" or "error message".
+// Connections run concurrently. Opened encoders and configured filter graphs
+// outlive the jobs, so a job like an earlier one skips most of its setup.
+// With -shm each job publishes to a ring of its own, ring_name.N. Once
+// options.cancel is cancelled it stops accepting, cancels the running jobs
+// and returns when their connections are closed.
+static void serve(const char *path, Options options, const Placement& placement)
+{
+   options.encoders.reset(new EncoderPool);
+   options.graphs.reset(new GraphPool);
+   // a client that hangs up must not take the daemon with it
+   signal(SIGPIPE, SIG_IGN);
+
+   struct sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if (strlen(path) >= sizeof(address.sun_path))
+      throw std::runtime_error(std::string("Socket path too long: ") + path);
+   strcpy(address.sun_path, path);
+   int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (listener < 0)
+      throw std::runtime_error(std::string("Could not create socket: ") + strerror(errno));
+   // a socket left behind by an earlier daemon
+   unlink(path);
+   if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+      std::string error(strerror(errno));
+      ::close(listener);
+      throw std::runtime_error(std::string("Could not listen on ") + path + ": " + error);
+   }
+   cerr <<"serving jobs on " <<path <<endl;
+   Connections connections;
+   std::string error;
+   struct pollfd pending = { listener, POLLIN, 0 };
+   while (error.empty() && !options.cancel->cancelled()) {
+      // a signal doesn't interrupt accept reliably, the token is polled
+      int ready = poll(&pending, 1, CancelToken::BOUND_MS);
+      if (ready == 0)
+         continue;
+      int client = ready > 0 ? accept(listener, NULL, NULL) : -1;
+      if (client < 0) {
+         if (errno != EINTR)
+            error = strerror(errno);
+         continue;
+      }
+      std::lock_guard<std::mutex> lock(connections.mutex);
+      connections.clients.insert(client);
+      std::thread(serveClient, client, options, std::cref(placement), std::ref(connections)).detach();
+   }
+   ::close(listener);
+   unlink(path);
+   // the jobs are cancelled with the daemon; no more lines are read, the
+   // replies still go out. The connections refer to this frame, they end
+   // before it does, even on an error.
+   options.cancel->cancel();
+   std::unique_lock<std::mutex> lock(connections.mutex);
+   for (auto client(connections.clients.begin()); client != connections.clients.end(); ++client)
+      shutdown(*client, SHUT_RD);
+   connections.cond.wait(lock, [&] { return connections.clients.empty(); });
+   if (!error.empty())
+      throw std::runtime_error("Could not accept a connection: " + error);
+   cerr <<"stopped serving jobs on " <<path <<endl;
+}
+
+// The token of the command line job or of the daemon, cancelled by SIGINT
+// and SIGTERM.
+static CancelToken *signalToken;
+
+static void cancelOnSignal(int)
+{
+   signalToken->cancel();
+}
+
+// Ctrl-C stops the stages within CancelToken::BOUND_MS and a frame, a
+// second one kills the process.
+static void cancelOnSignals(Options& options)
+{
+   options.cancel.reset(new CancelToken);
+   signalToken = options.cancel.get();
+   struct sigaction action;
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = cancelOnSignal;
+   action.sa_flags = SA_RESETHAND;
+   sigemptyset(&action.sa_mask);
+   sigaction(SIGINT, &action, NULL);
+   sigaction(SIGTERM, &action, NULL);
+}
+
 int
 main(int argc, char **argv)
 try
 {
-   if (argc != 3) {
-      cerr <<"usage: " <<argv[0] <<argv[0] <<"input_file video_output_file" <<std::endl;
-      exit(1);
+   Options options;
+   std::vector<Rendition> renditions(1);
+   const char *analyzeSidecar(nullptr);
+   std::string placementSpec;
+   const char *traceFile(nullptr);
+   const char *serveSocket(nullptr);
+   int repeat(1);
+   // kB the resident size may grow after the warm-up run of a soak test
+   int64_t rssGrowth(8192);
+   int arg(1);
+   for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+      if (!strcmp(argv[arg], "-unfused"))
+         options.fused = false;
+      else if (!strcmp(argv[arg], "-an"))
+         options.audio = false;
+      else if (!strcmp(argv[arg], "-vf") && arg + 1 < argc)
+         options.filters = argv[++arg];
+      else if (!strcmp(argv[arg], "-vcodec") && arg + 1 < argc)
+         parseCodec(argv[++arg], renditions[0].config);
+      else if (!strcmp(argv[arg], "-gain") && arg + 1 < argc)
+         options.gain = atof(argv[++arg]);
+      else if (!strcmp(argv[arg], "-analyze") && arg + 1 < argc)
+         analyzeSidecar = argv[++arg];
+      else if (!strcmp(argv[arg], "-deflicker") && arg + 1 < argc)
+         options.deflickerSidecar = argv[++arg];
+      else if (!strcmp(argv[arg], "-dedup") && arg + 1 < argc)
+         options.dedupThreshold = atof(argv[++arg]);
+      else if (!strcmp(argv[arg], "-pages") && arg + 1 < argc) {
+         ++arg;
+         if (!strcmp(argv[arg], "normal"))
+            options.allocatorConfig.pages = FrameAllocatorConfig::NORMAL;
+         else if (!strcmp(argv[arg], "thp"))
+            options.allocatorConfig.pages = FrameAllocatorConfig::TRANSPARENT;
+         else if (!strcmp(argv[arg], "huge"))
+            options.allocatorConfig.pages = FrameAllocatorConfig::EXPLICIT;
+         else
+            usage(argv[0]);
+         options.pages = true;
+      }
+      else if (!strcmp(argv[arg], "-node") && arg + 1 < argc)
+         options.allocatorConfig.node = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-place") && arg + 1 < argc)
+         placementSpec = argv[++arg];
+      else if (!strcmp(argv[arg], "-trace") && arg + 1 < argc)
+         traceFile = argv[++arg];
+      else if (!strcmp(argv[arg], "-quality") && arg + 1 < argc)
+         options.quality.interval = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-qualitycsv") && arg + 1 < argc)
+         options.quality.csv = argv[++arg];
+      else if (!strcmp(argv[arg], "-crc") && arg + 1 < argc)
+         options.checksums = argv[++arg];
+      else if (!strcmp(argv[arg], "-perf"))
+         options.perf = true;
+      else if (!strcmp(argv[arg], "-allocs"))
+         options.allocations = true;
+      else if (!strcmp(argv[arg], "-repeat") && arg + 1 < argc)
+         repeat = std::max(1, atoi(argv[++arg]));
+      else if (!strcmp(argv[arg], "-rssgrowth") && arg + 1 < argc)
+         rssGrowth = std::max(0, atoi(argv[++arg]));
+      else if (!strcmp(argv[arg], "-serve") && arg + 1 < argc)
+         serveSocket = argv[++arg];
+      else if (!strcmp(argv[arg], "-shm") && arg + 1 < argc)
+         options.ringName = argv[++arg];
+      else if (!strcmp(argv[arg], "-fragment") && arg + 1 < argc)
+         options.fragmentDuration = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-flush") && arg + 1 < argc)
+         options.flushInterval = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-live"))
+         options.live = true;
+      else if (!strcmp(argv[arg], "-drop") && arg + 1 < argc)
+         options.dropLate = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-timeout") && arg + 1 < argc)
+         options.timeout = atof(argv[++arg]);
+      else if (!strcmp(argv[arg], "-iotimeout") && arg + 1 < argc)
+         options.ioTimeout = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-checkpoint") && arg + 1 < argc)
+         options.checkpointInterval = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-resume"))
+         options.resume = true;
+      else if (!strcmp(argv[arg], "-rendition") && arg + 1 < argc)
+         renditions.push_back(parseRendition(argv[++arg]));
+      else
+         usage(argv[0]);
    }
-   
-   Filter filter(argv[1]);
-   Muxer muxer(argv[2]);
 
-   for(;;)
-   {
-      int windowSize(10);
-      Images& images = filter.readVideoFrames(windowSize);
+   // several jobs share a box by giving each its own CPUs, e.g.
+   // -place decode=0-1:encode=node0 and -place decode=16-17:encode=node1
+   Topology topology = Topology::detect();
+   Placement placement(topology, placementSpec);
+   if (!placement.empty()) {
+      topology.describe(cerr);
+      placement.describe(cerr);
+   }
+   // the reading thread and the decoder threads it starts
+   placement.pin(Placement::DECODE);
 
-      int index(0);
-      // Defliciring images here accessing by index in [0,windowSize-1] range
-      images[index]->data[0];
-      images[index]->linesizes[0];
+   if (serveSocket) {
+      // the options apply to every job, the jobs name the files
+      if (argc != arg || options.resume)
+         usage(argv[0]);
+      // stops the daemon and its jobs
+      cancelOnSignals(options);
+      serve(serveSocket, options, placement);
+      return 0;
+   }
+   if (analyzeSidecar) {
+      // first pass of a two-pass job: statistics only, no output file
+      if (argc - arg != 1)
+         usage(argv[0]);
+      auto start = chrono::steady_clock::now();
+      Analyzer analyzer(argv[arg]);
+      int frames = analyzer.run(analyzeSidecar);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      Statistics statistics(analyzeSidecar);
+      cout <<frames <<" frames analyzed in " <<seconds <<" s (" <<frames / seconds <<" fps, "
+           <<analyzer.duration() / seconds <<"x real time), " <<statistics.sceneCuts()
+           <<" scene cuts" <<endl;
+      return 0;
+   }
+   // a complete run removes the checkpoints a next one would resume from
+   if (argc - arg != 2 || (options.resume && (repeat > 1 || options.checkpointInterval <= 0)))
+      usage(argv[0]);
+   renditions[0].filename = argv[arg + 1];
 
-      if(images.empty()) break;
-      muxer.writeVideoFrames((Images&)images);
+   if (traceFile) {
+      Trace::start();
+      Trace::setThreadName("reader");
+   }
+
+   cancelOnSignals(options);
+
+   // Soak test: the same job over and over in one process. The first run
+   // warms up the allocators and the pools, after it the resident size must
+   // stay within rssGrowth kB, anything more is a leak and fails the process.
+   // The runs share encoders and graphs like daemon jobs.
+   if (repeat > 1) {
+      options.encoders.reset(new EncoderPool);
+      options.graphs.reset(new GraphPool);
+   }
+   int64_t firstResident(0), peakGrowth(0), frames(0);
+   int64_t allocations(0);
+   for (int run(0); run < repeat; ++run) {
+      JobResult result = remux(argv[arg], renditions, options, placement);
+      allocations += result.steadyAllocations;
+      frames += result.frames;
+      if (repeat > 1) {
+         int64_t resident = residentBytes();
+         if (run == 0)
+            firstResident = resident;
+         peakGrowth = std::max(peakGrowth, resident - firstResident);
+         cerr <<"run " <<run + 1 <<"/" <<repeat <<": " <<frames <<" frames so far, resident "
+              <<resident / 1024 <<" kB (" <<showpos <<(resident - firstResident) / 1024 <<noshowpos
+              <<" kB since the first run)" <<endl;
+      }
+   }
+   if (traceFile)
+      Trace::write(traceFile);
+   if (allocations) {
+      cerr <<"steady-state encoding allocated on the heap " <<allocations <<" times" <<endl;
+      return 1;
+   }
+   if (repeat > 1) {
+      cerr <<repeat <<" runs, " <<frames <<" frames: resident size grew at most " <<peakGrowth / 1024
+           <<" kB after the first run, " <<rssGrowth <<" kB allowed" <<endl;
+      if (peakGrowth > rssGrowth * 1024)
+         return 1;
    }
 
    return 0;
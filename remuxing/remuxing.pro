@@ -4,19 +4,7 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 include(../ff.prf)
+include(../libff/libff.pri)
 
 SOURCES += \
-    demuxer.cpp \
-    muxer.cpp \
-    filter.cpp \
-    image.cpp \
     remuxer.cpp
-
-HEADERS += \
-    demuxer.h \
-    muxer.h \
-    filter.h \
-    config.h \
-    image.h \
-    libav.h
-
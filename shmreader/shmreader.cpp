@@ -0,0 +1,113 @@
+#include "shmring.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Reads every byte of the frame the way an analysis tool would.
+static uint64_t consume(const ShmFrame& frame)
+{
+   uint64_t sum(0);
+   const uint64_t *word = reinterpret_cast<const uint64_t*>(frame.data[0]);
+   for (uint32_t i(0); i < frame.size / sizeof(uint64_t); ++i)
+      sum += word[i];
+   return sum;
+}
+
+static void report(uint64_t frames, uint64_t bytes, uint64_t dropped, double seconds)
+{
+   cout <<frames <<" frames, " <<dropped <<" dropped in " <<seconds <<" s: "
+        <<frames / seconds <<" fps, " <<bytes / seconds / (1024. * 1024. * 1024.) <<" GB/s" <<endl;
+}
+
+static void read(const char *name)
+{
+   ShmRingReader reader(name);
+   const ShmRingHeader& header = reader.header();
+   cout <<"ring " <<name <<": " <<header.slotCount <<" slots of " <<header.slotSize <<" bytes, "
+        <<header.width <<"x" <<header.height <<" pix_fmt " <<header.pixFmt <<endl;
+
+   ShmFrame frame;
+   uint64_t frames(0), bytes(0), checksum(0), torn(0);
+   auto start = chrono::steady_clock::now();
+   while (reader.next(frame)) {
+      checksum += consume(frame);
+      if (!reader.valid(frame)) {
+         // the producer lapped us while we were reading
+         ++torn;
+         continue;
+      }
+      ++frames;
+      bytes += frame.size;
+   }
+   report(frames, bytes, reader.dropped() + torn, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+   if (checksum == 1)
+      cout <<endl; // keep the reads
+}
+
+// Producer and consumer in one process: measures the ring itself.
+static void bench(uint64_t count, int width, int height)
+{
+   const char *name = "/ff_shmreader_bench";
+   int size = width * height * 2;
+   ShmRingWriter writer(name, 8, size, width, height, -1);
+   ShmRingReader reader(name);
+
+   std::vector<uint8_t> source(size, 0x5a);
+   std::thread producer([&] {
+      int offsets[4] = {0}, linesizes[4] = {width * 2};
+      for (uint64_t i(0); i < count; ++i) {
+         memcpy(writer.acquire(), source.data(), size);
+         writer.commit(i, size, offsets, linesizes);
+      }
+   });
+
+   ShmFrame frame;
+   uint64_t frames(0), bytes(0), checksum(0), torn(0);
+   auto start = chrono::steady_clock::now();
+   while (frames + torn + reader.dropped() < count && reader.next(frame)) {
+      checksum += consume(frame);
+      if (!reader.valid(frame)) {
+         ++torn;
+         continue;
+      }
+      ++frames;
+      bytes += frame.size;
+   }
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+   producer.join();
+   report(frames, bytes, count - frames, seconds);
+   if (checksum == 1)
+      cout <<endl;
+}
+
+int
+main(int argc, char **argv)
+try
+{
+   if (argc >= 2 && !strcmp(argv[1], "-bench")) {
+      uint64_t count = argc > 2 ? atoll(argv[2]) : 1000;
+      int width(1920), height(1080);
+      if (argc > 3)
+         sscanf(argv[3], "%dx%d", &width, &height);
+      bench(count, width, height);
+      return 0;
+   }
+   if (argc != 2) {
+      cerr <<"usage: " <<argv[0] <<" ring_name | -bench [frames] [WxH]" <<endl;
+      return 1;
+   }
+   read(argv[1]);
+   return 0;
+}
+catch(std::exception &e)
+{
+   std::cerr <<e.what() <<std::endl;
+   return 1;
+}
@@ -0,0 +1,18 @@
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# the ring consumer does not need libav
+QMAKE_CXXFLAGS += -std=c++11 -pthread
+LIBS += -lrt -pthread
+
+INCLUDEPATH += ../libff
+
+SOURCES += \
+    shmreader.cpp \
+    ../libff/shmring.cpp
+
+HEADERS += \
+    ../libff/shmring.h
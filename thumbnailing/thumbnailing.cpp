@@ -0,0 +1,54 @@
+#include "thumbnailer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+static void usage(const char *name)
+{
+   cerr <<"usage: " <<name <<" [-interval s] [-width w] [-lowres n] [-threads n] [-sheet columns]"
+        <<" input_file output_prefix" <<endl
+        <<"writes output_prefixNNNNN.ppm per thumbnail, or output_prefixsheet.ppm with -sheet" <<endl;
+   exit(1);
+}
+
+int
+main(int argc, char **argv)
+try
+{
+   ThumbnailConfig config;
+   int arg(1);
+   for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+      if (!strcmp(argv[arg], "-interval") && arg + 1 < argc)
+         config.interval = atof(argv[++arg]);
+      else if (!strcmp(argv[arg], "-width") && arg + 1 < argc)
+         config.width = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-lowres") && arg + 1 < argc)
+         config.lowres = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-threads") && arg + 1 < argc)
+         config.threads = atoi(argv[++arg]);
+      else if (!strcmp(argv[arg], "-sheet") && arg + 1 < argc)
+         config.columns = atoi(argv[++arg]);
+      else
+         usage(argv[0]);
+   }
+   if (argc - arg != 2 || config.interval <= 0 || config.width < 2)
+      usage(argv[0]);
+
+   auto start = chrono::steady_clock::now();
+   Thumbnailer thumbnailer(argv[arg], config);
+   int thumbnails = thumbnailer.extract(argv[arg + 1]);
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+   cout <<thumbnails <<" thumbnails from " <<thumbnailer.duration() <<" s of video in "
+        <<seconds <<" s (" <<thumbnailer.duration() / seconds <<"x real time)" <<endl;
+   return 0;
+}
+catch(std::exception &e)
+{
+   std::cout <<e.what()<<std::endl;
+   return 1;
+}
@@ -0,0 +1,11 @@
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+include(../ff.prf)
+include(../libff/libff.pri)
+
+SOURCES += \
+    thumbnailing.cpp